@@ -0,0 +1,26 @@
+# Build MAIN as a host (Linux) executable against the Arduino API in lib/native (virtual or real time, scripted pin
+# inputs and emulated Serial on stdout or a pty, see lib/native/Arduino.h). Useful for running the firmware logic under
+# perf, gdb or sanitizers, like:
+#
+#   make BOARD=Native MAIN=pendel/pendel NATIVE_CXXFLAGS="-fsanitize=address,undefined" run ARGS="-v -t 60"
+
+NATIVE_CXX = g++
+
+NATIVE_CXXFLAGS =
+
+NATIVE_LIBS =
+
+BUILD = $(MAIN)-native
+
+# Compile, objects are kept apart from board objects.
+%.native.o: %.cpp
+	$(NATIVE_CXX) $(CXXFLAGS) $(NATIVE_CXXFLAGS) -DNATIVE_MAIN -I$(BASE_DIR)/lib/native -c -o $@ $<
+
+# Link.
+%-native: %.native.o
+	$(NATIVE_CXX) $(NATIVE_CXXFLAGS) -o $@ $^ $(NATIVE_LIBS)
+
+run: $(MAIN)-native
+	./$< $(ARGS)
+
+.PRECIOUS: %.native.o
@@ -1,6 +1,7 @@
 
 BOARD = ArduinoUno
 # BOARD = Teensy32
+# BOARD = Native
 
 BAUD_RATE = 9600
 
@@ -4,6 +4,10 @@
 // Lib for cpp micro controller base stuff.
 //
 
+#if defined(__AVR__)
+#include <avr/sleep.h>
+#endif
+
 // Led pin to flash in case of errors.
 #ifndef LED_PIN
 #define LED_PIN 14
@@ -12,14 +16,47 @@
 using pin_t       = uint8_t;
 using pin_value_t = uint8_t;
 
+// Width of timestamp_t in bits. 32 bit timestamps wrap after 71 minutes, 64 bit timestamps are extended from micros()
+// and does not wrap, but are a bit more expensive to handle (especially on 8 bit cpus).
+#ifndef TIMESTAMP_BITS
+#define TIMESTAMP_BITS 32
+#endif
+
 using delay_t     = uint32_t;
+#if TIMESTAMP_BITS == 64
+using timestamp_t = uint64_t;
+#else
 using timestamp_t = uint32_t;
+#endif
 
 using ang_t = int16_t;
 
 constexpr pin_value_t OFF = 0;
 constexpr pin_value_t ON = 1;
 
+// Disable interrupts while in scope, then restore the previous interrupt state (so it can be used inside interrupts
+// too).
+struct interrupt_lock
+{
+#if defined(__AVR__)
+   interrupt_lock() : _sreg(SREG) { cli(); }
+   ~interrupt_lock() { SREG = _sreg; }
+private:
+   uint8_t _sreg;
+#elif defined(__arm__)
+   interrupt_lock() { __asm__ volatile("mrs %0, primask\n cpsid i" : "=r" (_primask) :: "memory"); }
+   ~interrupt_lock() { __asm__ volatile("msr primask, %0" :: "r" (_primask) : "memory"); }
+private:
+   uint32_t _primask;
+#else
+   // Unknown cpu, will enable interrupts when done even if used inside an interrupt.
+   interrupt_lock() { noInterrupts(); }
+   ~interrupt_lock() { interrupts(); }
+#endif
+};
+
+#include "clock.hpp"
+
 // Blink error message, the blink will be 1s off then 125ms on/off for each bit in argument. So for example
 // 0b11001100 will be two 250ms flashes, then 1250ms off.
 void blink_error(uint8_t message)
@@ -37,8 +74,61 @@ void blink_error(uint8_t message)
    }
 }
 
+extended_clock micros_clock;
+
+// Return current time in micro seconds since device power up as a 64 bit value that does not wrap. It needs to be
+// called at least once every 71 minutes to not miss a micros() wrap (the event queue does this when running with 64
+// bit timestamps).
+uint64_t now_us64()
+{
+   return micros_clock.extend(micros());
+}
+
 // Return current time in micro seconds since device power up.
 timestamp_t now_us()
 {
+#if TIMESTAMP_BITS == 64
+   return now_us64();
+#else
    return micros();
+#endif
 }
+
+// Max time between wake ups when sleeping, this is the timer interrupt driving micros() (timer0 overflow on avr,
+// systick on arm).
+#ifndef IDLE_WAKE_US
+#if defined(__AVR__)
+#define IDLE_WAKE_US 1024
+#else
+#define IDLE_WAKE_US 1000
+#endif
+#endif
+
+// Margin before a deadline where we spin instead of sleeping, covers wake up latency.
+#ifndef IDLE_SPIN_US
+#define IDLE_SPIN_US 50
+#endif
+
+// Idle strategy for the event queue. Sleeps the cpu until the next interrupt if the deadline is far enough away to be
+// sure to wake up before it, otherwise returns directly and let the event queue spin out the rest for precision. Any
+// interrupt wakes it up so interrupt posted work is not delayed. On host (lib/native) it jumps to the deadline in
+// virtual time, or sleeps a while in real time.
+struct sleep_idle
+{
+   static inline void idle(const timestamp_t& now, const timestamp_t& when)
+   {
+#if defined(__AVR__) || defined(__arm__)
+      if (timestamp_t(when - now) < IDLE_WAKE_US + IDLE_SPIN_US) {
+         return;
+      }
+#endif
+#if defined(__AVR__)
+      set_sleep_mode(SLEEP_MODE_IDLE);
+      sleep_mode();
+#elif defined(__arm__)
+      __asm__ volatile("wfi");
+#else
+      native_idle(timestamp_t(when - now));
+#endif
+   }
+};
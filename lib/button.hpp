@@ -0,0 +1,198 @@
+#pragma once
+
+//
+// Interrupt driven button, the pin interrupt only records the time of the edge and posts the button to the event queue
+// (see event_queue::post_isr), where the value is accepted when the pin has been stable for BUTTON_DEBOUNCE. Press and
+// release callbacks are enqueued on changes, so nothing needs to poll the button. If the pin has no interrupt (or all
+// interrupt slots are used) it falls back to polling every BUTTON_POLL_INTERVAL while a callback is waiting, and
+// value() and pressed() read the pin directly like button.
+//
+// With leading, a change is accepted at once on the first edge after the pin has been stable for BUTTON_DEBOUNCE and
+// only the way back is debounced, for buttons that need to react without delay (like an emergency stop).
+//
+
+#include "event_queue.hpp"
+#include "interrupt.hpp"
+#include "util.hpp"
+
+// Time the pin needs to be stable before a change is accepted (us).
+#ifndef BUTTON_DEBOUNCE
+#define BUTTON_DEBOUNCE (20 * MILLIS)
+#endif
+
+// Poll interval when the pin has no interrupt (us).
+#ifndef BUTTON_POLL_INTERVAL
+#define BUTTON_POLL_INTERVAL (1 * MILLIS)
+#endif
+
+struct event_button : event_queue::callback_obj_at
+{
+   // Init with pin.
+   event_button(event_queue& event_queue, pin_t pin, bool inverted=false, bool leading=false) :
+      _event_queue(event_queue), _button(pin, inverted), _leading(leading), _value(_button.value()), _released(false),
+      _posted(false), _edge_at(0), _lead(false), _lead_value(false), _on_press(nullptr), _on_release(nullptr),
+      _press_lane(0), _release_lane(0)
+   {
+      _interrupt = attach_interrupt(pin, _interrupt_fun, this, CHANGE);
+   }
+
+   // The interrupt refers to the instance.
+   event_button(const event_button&) = delete;
+   event_button& operator=(const event_button&) = delete;
+
+   // Return debounced button value.
+   bool value()
+   {
+      _sync();
+      return _value;
+   }
+
+   // Return true if a release has been detected since last call (low flank).
+   bool pressed()
+   {
+      _sync();
+      bool released = _released;
+      _released = false;
+      return released;
+   }
+
+   // Enqueue callback (once) on the next press.
+   void on_press(event_queue::callback_fun_at_t callback, uint8_t lane=0)
+   {
+      _on_press = callback;
+      _press_lane = lane;
+      _watch();
+   }
+
+   // Enqueue callback (once) on the next release.
+   void on_release(event_queue::callback_fun_at_t callback, uint8_t lane=0)
+   {
+      _on_release = callback;
+      _release_lane = lane;
+      _watch();
+   }
+
+   // Debounce after an edge, or poll.
+   void operator()(event_queue& eq, const timestamp_t& when) override
+   {
+      if (_interrupt) {
+         uint32_t since;
+         {
+            interrupt_lock lock;
+            since = micros() - _edge_at;
+            if (since >= BUTTON_DEBOUNCE) {
+               _posted = false;
+            }
+         }
+         if (since < BUTTON_DEBOUNCE) {
+            // A leading edge is accepted now, the rest when stable.
+            _sync();
+            eq.enqueue_rel(this, BUTTON_DEBOUNCE - since);
+            return;
+         }
+         _sync();
+      }
+      else {
+         _sync();
+         if (_on_press or _on_release) {
+            eq.enqueue_rel(this, BUTTON_POLL_INTERVAL);
+         }
+      }
+   }
+
+   virtual ~event_button()
+   {
+      if (_interrupt) {
+         detach_interrupt(_button.pin());
+      }
+   }
+
+private:
+
+   static void _interrupt_fun(void* context)
+   {
+      auto self = static_cast<event_button*>(context);
+      uint32_t now = micros();
+      if (self->_leading and now - self->_edge_at >= BUTTON_DEBOUNCE) {
+         self->_lead_value = self->_button.value();
+         self->_lead = true;
+      }
+      self->_edge_at = now;
+      if (not self->_posted) {
+         self->_posted = self->_event_queue.post_isr(self);
+      }
+   }
+
+   // Make sure the button gets called when waiting for a callback, the event may have been dropped by a queue reset.
+   void _watch()
+   {
+      if (not _event_queue.present(this)) {
+         _posted = true;
+         _event_queue.enqueue_now(this);
+      }
+   }
+
+   // Accept the pin value if stable (or the value at a leading edge), enqueue callbacks on change.
+   void _sync()
+   {
+      if (_interrupt) {
+         uint32_t edge_at;
+         bool lead;
+         bool lead_value;
+         {
+            interrupt_lock lock;
+            edge_at = _edge_at;
+            lead = _lead;
+            lead_value = _lead_value;
+            _lead = false;
+         }
+         if (micros() - edge_at < BUTTON_DEBOUNCE) {
+            if (lead) {
+               _set(lead_value);
+            }
+            return;
+         }
+      }
+
+      _set(_button.value());
+   }
+
+   // Set debounced value, enqueue callbacks on change.
+   void _set(bool value)
+   {
+      if (value == _value) {
+         return;
+      }
+      _value = value;
+      if (value) {
+         _fire(_on_press, _press_lane);
+      }
+      else {
+         _released = true;
+         _fire(_on_release, _release_lane);
+      }
+   }
+
+   void _fire(event_queue::callback_fun_at_t& callback, uint8_t lane)
+   {
+      if (callback) {
+         _event_queue.enqueue_now(callback, lane);
+         callback = nullptr;
+      }
+   }
+
+   event_queue& _event_queue;
+   button _button;
+   bool _leading;
+   bool _interrupt;
+   bool _value;
+   bool _released;
+   volatile bool _posted;
+   volatile uint32_t _edge_at;
+   volatile bool _lead;
+   volatile bool _lead_value;
+   event_queue::callback_fun_at_t _on_press;
+   event_queue::callback_fun_at_t _on_release;
+   uint8_t _press_lane;
+   uint8_t _release_lane;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+//
+// Wrap free 64 bit time extended from a wrapping 32 bit micro second counter (micros() wraps every 71 minutes).
+//
+
+struct extended_clock
+{
+   extended_clock() : _last(0), _epoch(0) {}
+
+   // Readings less than this older than the last reading are considered stale rather than a full lap ahead.
+   static constexpr uint32_t STALE_US = uint32_t(1) << 24;
+   
+   // Extend now, a reading of the 32 bit counter, to 64 bits. Readings need to be less than 71 minutes apart to notice
+   // all wraps. Safe to call from interrupts, a reading that is a bit older than the last one (because an interrupt
+   // extended a newer reading in between) is handled.
+   uint64_t extend(uint32_t now)
+   {
+      interrupt_lock lock;
+      uint32_t epoch = _epoch;
+      if (uint32_t(_last - now) < STALE_US) {
+         // Stale reading, it is from before the last wrap if numerically larger.
+         if (now > _last) {
+            --epoch;
+         }
+      }
+      else {
+         // Newer reading, it wrapped if numerically smaller.
+         if (now < _last) {
+            epoch = ++_epoch;
+         }
+         _last = now;
+      }
+      return (uint64_t(epoch) << 32) | now;
+   }
+   
+private:
+   uint32_t _last;
+   uint32_t _epoch;
+};
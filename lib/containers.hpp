@@ -0,0 +1,239 @@
+#pragma once
+
+//
+// Fixed capacity containers in static storage:
+//
+//   ring_buffer<T, capacity>  double ended circular buffer, indexed from the front
+//   static_vector<T, capacity> vector without heap
+//   spsc_queue<T, capacity>   queue with one producer and one consumer (like an interrupt and the main loop)
+//
+// Ring indexes never wrap with a modulo, it is a division and costs hundreds of cycles on avr (see
+// lib/test/containers_bench.hpp). A ring_buffer with a power of two capacity wraps with an and, any other capacity
+// with a compare, so the storage can match the configured size. The spsc_queue needs a power of two. Elements are
+// copied with assignment, except the bulk operations of ring_buffer that use memcpy and are meant for bytes.
+//
+
+#include <stdint.h>
+#include <string.h>
+
+template<typename T, uint16_t capacity>
+struct ring_buffer
+{
+   static_assert(capacity > 0, "capacity needs to be at least one");
+
+   ring_buffer() : _front(0), _size(0) {}
+
+   inline uint16_t size() const { return _size; }
+
+   inline bool empty() const { return _size == 0; }
+
+   inline bool full() const { return _size == capacity; }
+
+   static constexpr uint16_t max_size() { return capacity; }
+
+   void clear()
+   {
+      _front = 0;
+      _size = 0;
+   }
+
+   // Element i from the front.
+   inline T& operator[](uint16_t i) { return _data[_wrap(uint32_t(_front) + i)]; }
+
+   inline const T& operator[](uint16_t i) const { return _data[_wrap(uint32_t(_front) + i)]; }
+
+   inline T& front() { return _data[_front]; }
+
+   inline T& back() { return (*this)[_size - 1]; }
+
+   // Add at the back, returns false if full.
+   inline bool push_back(const T& value)
+   {
+      if (full()) {
+         return false;
+      }
+      _data[_wrap(uint32_t(_front) + _size)] = value;
+      ++_size;
+      return true;
+   }
+
+   // Add at the front, returns false if full.
+   inline bool push_front(const T& value)
+   {
+      if (full()) {
+         return false;
+      }
+      _front = _wrap(uint32_t(_front) + capacity - 1);
+      _data[_front] = value;
+      ++_size;
+      return true;
+   }
+
+   // Add at the front, when full the back element is dropped to make room (a history with the latest first).
+   inline void push_front_overwrite(const T& value)
+   {
+      if (full()) {
+         --_size;
+      }
+      push_front(value);
+   }
+
+   // Remove front element, there needs to be one.
+   inline void pop_front()
+   {
+      _front = _wrap(uint32_t(_front) + 1);
+      --_size;
+   }
+
+   // Remove back element, there needs to be one.
+   inline void pop_back()
+   {
+      --_size;
+   }
+
+   // Copy len elements to the back with at most two memcpy, there needs to be room.
+   void write(const T* data, uint16_t len)
+   {
+      uint16_t back = _wrap(uint32_t(_front) + _size);
+      uint16_t len1 = len < capacity - back ? len : capacity - back;
+      memcpy(_data + back, data, len1 * sizeof(T));
+      memcpy(_data, data + len1, (len - len1) * sizeof(T));
+      _size += len;
+   }
+
+   // Copy len elements from the front and remove them, there needs to be len elements.
+   void read(T* data, uint16_t len)
+   {
+      uint16_t len1 = len < capacity - _front ? len : capacity - _front;
+      memcpy(data, _data + _front, len1 * sizeof(T));
+      memcpy(data + len1, _data, (len - len1) * sizeof(T));
+      skip(len);
+   }
+
+   // Remove len elements from the front, there needs to be len elements.
+   inline void skip(uint16_t len)
+   {
+      _front = _wrap(uint32_t(_front) + len);
+      _size -= len;
+   }
+
+   // Number of elements from the front that are contiguous in memory (starting at &front()).
+   inline uint16_t front_span() const
+   {
+      return _size < capacity - _front ? _size : capacity - _front;
+   }
+
+private:
+   static constexpr bool POW2 = (capacity & (capacity - 1)) == 0;
+   static constexpr uint16_t MASK = capacity - 1;
+
+   // Index i (below two times capacity) into storage, the branch is resolved at compile time.
+   static inline uint16_t _wrap(uint32_t i)
+   {
+      return POW2 ? i & MASK : i >= capacity ? i - capacity : i;
+   }
+
+   T _data[capacity];
+   uint16_t _front;
+   uint16_t _size;
+};
+
+template<typename T, uint16_t capacity>
+struct static_vector
+{
+   static_vector() : _size(0) {}
+
+   inline uint16_t size() const { return _size; }
+
+   inline bool empty() const { return _size == 0; }
+
+   inline bool full() const { return _size == capacity; }
+
+   static constexpr uint16_t max_size() { return capacity; }
+
+   inline void clear() { _size = 0; }
+
+   inline T& operator[](uint16_t i) { return _data[i]; }
+
+   inline const T& operator[](uint16_t i) const { return _data[i]; }
+
+   inline T& back() { return _data[_size - 1]; }
+
+   inline T* begin() { return _data; }
+
+   inline T* end() { return _data + _size; }
+
+   inline const T* begin() const { return _data; }
+
+   inline const T* end() const { return _data + _size; }
+
+   // Add at the back, returns false if full.
+   inline bool push_back(const T& value)
+   {
+      if (full()) {
+         return false;
+      }
+      _data[_size++] = value;
+      return true;
+   }
+
+   // Remove back element, there needs to be one.
+   inline void pop_back()
+   {
+      --_size;
+   }
+
+private:
+   T _data[capacity];
+   uint16_t _size;
+};
+
+// Queue that is safe without locks when one side only pushes and the other only pops, for example push from an
+// interrupt and pop from the event queue. Head and tail are free running bytes (single byte access is atomic on avr),
+// their difference is the size, so all capacity slots can be used.
+template<typename T, uint8_t capacity>
+struct spsc_queue
+{
+   static_assert(capacity > 0 and capacity <= 128 and (capacity & (capacity - 1)) == 0,
+                 "capacity needs to be a power of two, max 128");
+
+   spsc_queue() : _head(0), _tail(0) {}
+
+   inline bool empty() const { return _head == _tail; }
+
+   inline uint8_t size() const { return uint8_t(_head - _tail); }
+
+   // Add value, returns false if full (producer side).
+   inline bool push(const T& value)
+   {
+      uint8_t head = _head;
+      if (uint8_t(head - _tail) == capacity) {
+         return false;
+      }
+      _data[head & MASK] = value;
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      _head = head + 1;
+      return true;
+   }
+
+   // Take value, returns false if empty (consumer side).
+   inline bool pop(T& value)
+   {
+      uint8_t tail = _tail;
+      if (tail == _head) {
+         return false;
+      }
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      value = _data[tail & MASK];
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      _tail = tail + 1;
+      return true;
+   }
+
+private:
+   static constexpr uint8_t MASK = capacity - 1;
+
+   T _data[capacity];
+   volatile uint8_t _head;
+   volatile uint8_t _tail;
+};
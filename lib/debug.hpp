@@ -1,5 +1,6 @@
 #pragma once
 
+#include "containers.hpp"
 #include "serial.hpp"
 
 // A simple container for debugging of messages and later dumping them.
@@ -9,34 +10,33 @@ struct debug_log
    debug_log()
    {
       for (uint16_t i = 0; i < size; ++i) {
-         _when[i] = 0;
-         _what[i] = "empty";
+         _log.push_back(entry{ 0, "empty" });
       }
-      _index = 0;
    }
 
    void log(const char* what)
    {
-      _index = uint16_t(_index - 1) % size;
-      _when[_index] = now_us();
-      _what[_index] = what;
+      _log.push_front_overwrite(entry{ now_us(), what });
    }
 
    void dump(noblock_serial& s)
    {
       timestamp_t last = now_us();
-      s.pr("dump at ", last, "\n");
+      s.pr("dump at ", uint32_t(last), "\n");
       for (uint16_t i = 0; i < size; ++i) {
-         auto index = (i + _index) % size;
-         timestamp_t when = _when[index];
-         s.pr(when, " ", _what[index], " (", last - when, " to next ^)\n");
+         timestamp_t when = _log[i].when;
+         s.pr(uint32_t(when), " ", _log[i].what, " (", uint32_t(last - when), " to next ^)\n");
          last = when;
       }
    }
    
 private:
-   timestamp_t _when[size];
-   const char* _what[size];
-   uint16_t _index;
-};
+   struct entry
+   {
+      timestamp_t when;
+      const char* what;
+   };
 
+   // Latest first.
+   ring_buffer<entry, size> _log;
+};
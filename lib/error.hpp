@@ -8,6 +8,8 @@ enum class error : uint8_t
 {
    EVENT_QUEUE_FULL,
    EVENT_QUEUE_EMPTY,
+   PARAMS_FULL,
+   INTERRUPT_SLOTS_FULL,
 };
 
 
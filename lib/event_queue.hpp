@@ -6,121 +6,173 @@
 
 //#include <functional>
 
+#include "containers.hpp"
 #include "error.hpp"
+#include "inline_fun.hpp"
+#include "profile.hpp"
 
-// Size of event queue.
+// Size of the default event queue (event_queue).
 #ifndef EVENTS_SIZE
 #define EVENTS_SIZE 16
 #endif
 
+// Number of priority lanes of the default event queue, among due events the one in the highest lane is dispatched
+// first.
+#ifndef EVENT_LANES
+#define EVENT_LANES 1
+#endif
+
+// Size of inline storage for callback captures in bytes, room for two pointers (at least 8 bytes).
+#ifndef EVENT_FUN_SIZE
+#define EVENT_FUN_SIZE (2 * sizeof(void*) < 8 ? 8 : 2 * sizeof(void*))
+#endif
+
+// Idle strategy of the default event queue (called when waiting for next event).
+#ifndef EVENT_QUEUE_IDLE
+#define EVENT_QUEUE_IDLE sleep_idle
+#endif
+
+// Max number of events posted from interrupts waiting (see post_isr), a power of two.
+#ifndef EVENT_QUEUE_POSTS
+#define EVENT_QUEUE_POSTS 8
+#endif
+
+// Trace hook, EVENT_QUEUE_TRACE(begin, lane) is called with begin true before and false after each dispatch (see
+// lib/trace.hpp). It needs to be declared before including this file.
+#ifndef EVENT_QUEUE_TRACE
+#define EVENT_QUEUE_TRACE(begin, lane)
+#endif
+
 using namespace std;
 
-struct event_queue
+// Idle strategy that does nothing, so the event queue spins until next event is due. An idle strategy has a static
+// idle(now, when) that is called repeatedly while waiting, it can return at any time before when.
+struct spin_idle
 {
-   struct callback_obj { virtual void operator()(event_queue& event_queue) = 0; };
-   struct callback_obj_at { virtual void operator()(event_queue& event_queue, const timestamp_t& when) = 0; };
+   static inline void idle(const timestamp_t& now, const timestamp_t& when) {}
+};
+
+// Smallest index type that can count to capacity.
+template<bool small> struct event_index_select { using type = uint16_t; };
+template<> struct event_index_select<true> { using type = uint8_t; };
+
+// Event queue with room for capacity events, index_t is used for indexing and counting events, so it needs to be able
+// to hold capacity. Events are dispatched in time order, except when several events are due, then the one in the
+// highest lane (0 to lanes - 1) goes first, so bulk work (like serial output) can't delay time critical events. While
+// waiting for the next event idle_t::idle is called (see sleep_idle and spin_idle).
+template<uint16_t capacity,
+         typename index_t=typename event_index_select<capacity <= 255>::type,
+         uint8_t lanes=1,
+         typename idle_t=sleep_idle>
+struct basic_event_queue
+{
+   static_assert(capacity > 0 and capacity <= index_t(~index_t(0)), "index_t too small for capacity");
+   static_assert(lanes > 0, "need at least one lane");
+   
+   struct callback_obj { virtual void operator()(basic_event_queue& event_queue) = 0; };
+   struct callback_obj_at { virtual void operator()(basic_event_queue& event_queue, const timestamp_t& when) = 0; };
    
-   using callback_fun_at_t = void (*)(event_queue& event_queue, const timestamp_t& when);
-   using callback_fun_t = void (*)(event_queue& event_queue);
+   using callback_fun_at_t = void (*)(basic_event_queue& event_queue, const timestamp_t& when);
+   using callback_fun_t = void (*)(basic_event_queue& event_queue);
    using callback_obj_at_t = callback_obj_at*;
    using callback_obj_t = callback_obj*;
 
-   using index_t = uint8_t;
+   // Callbacks are stored inline in the event, any callable with the callback_fun_at_t signature that fits in
+   // EVENT_FUN_SIZE bytes can be used (function pointers, functors or lambdas with small captures).
+   using fun_t = inline_fun<void(basic_event_queue& event_queue, const timestamp_t& when), EVENT_FUN_SIZE>;
 
-   enum kind_t:uint8_t { OBJ, OBJ_AT, FUN, FUN_AT };
+   // Adapters for the callback kinds without timestamp or called through objects.
+   struct fun_wrap {
+      callback_fun_t f;
+      inline void operator()(basic_event_queue& eq, const timestamp_t& when) { f(eq); }
+      inline bool operator==(const fun_wrap& w) const { return f == w.f; }
+   };
    
-   union fun_t {
-      callback_obj_t    obj;
-      callback_obj_at_t obj_at;
-      callback_fun_t    fun;
-      callback_fun_at_t fun_at;
+   struct obj_wrap {
+      callback_obj_t o;
+      inline void operator()(basic_event_queue& eq, const timestamp_t& when) { o->operator()(eq); }
+      inline bool operator==(const obj_wrap& w) const { return o == w.o; }
    };
+   
+   struct obj_at_wrap {
+      callback_obj_at_t o;
+      inline void operator()(basic_event_queue& eq, const timestamp_t& when) { o->operator()(eq, when); }
+      inline bool operator==(const obj_at_wrap& w) const { return o == w.o; }
+   };
+
+   static inline callback_fun_at_t wrap_ptr(callback_fun_at_t f) { return f; }
+   static inline fun_wrap          wrap_ptr(callback_fun_t f)    { return fun_wrap{f}; }
+   static inline obj_wrap          wrap_ptr(callback_obj_t o)    { return obj_wrap{o}; }
+   static inline obj_at_wrap       wrap_ptr(callback_obj_at_t o) { return obj_at_wrap{o}; }
 
-   // One event in the event loop. Since we don't want to use new, we can't use functor objects, thus the union fun_t
-   // instead. It's a bit ugly but it works. (std::function also uses new in some cases.)
+   // Turn callback into something callable as callback_fun_at_t, pointers (to functions or callback objects) are
+   // adapted, functors and lambdas are used as is.
+   template<typename T> static inline auto wrap(T* callback) -> decltype(wrap_ptr(callback)) { return wrap_ptr(callback); }
+   template<typename T> static inline const T& wrap(const T& callback) { return callback; }
+   
+   // One event in the event loop.
    struct event
    {
-      kind_t         kind;
-      fun_t          fun;
-      timestamp_t    when;
-
-      inline void fun_set(callback_obj_at_t f) { fun.obj_at = f; kind = OBJ_AT; }
-      inline void fun_set(callback_obj_t f)    { fun.obj = f;    kind = OBJ; }
-      inline void fun_set(callback_fun_at_t f) { fun.fun_at = f; kind = FUN_AT; }
-      inline void fun_set(callback_fun_t f)    { fun.fun = f;    kind = FUN; }
-
-      inline bool fun_eq(callback_obj_at_t f) { return kind == OBJ_AT and fun.obj_at == f; }
-      inline bool fun_eq(callback_obj_t f)    { return kind == OBJ    and fun.obj == f; }
-      inline bool fun_eq(callback_fun_at_t f) { return kind == FUN_AT and fun.fun_at == f; }
-      inline bool fun_eq(callback_fun_t f)    { return kind == FUN    and fun.fun == f; }
-
-      inline void operator()(event_queue& eq)
-      {
-         switch (kind) {
-            case OBJ:    fun.obj->operator()(eq); break;
-            case OBJ_AT: fun.obj_at->operator()(eq, when); break;
-            case FUN:    fun.fun(eq); break;
-            case FUN_AT: fun.fun_at(eq, when); break;
-         }
-      }
-      
-      void operator=(const event& other) {
-         fun = other.fun;
-         kind = other.kind;
-         when = other.when;
-      }
+      fun_t       fun;
+      timestamp_t when;
+      uint8_t     lane;
    };
 
    // This is a sorted circular buffer with the next event first.
-   event _events[EVENTS_SIZE];
-
-   // Index of front of the queue.
-   index_t _index;
-
-   // Current number of elements.
-   index_t _size;
+   ring_buffer<event, capacity> _events;
 
    bool _run;
+
+   // Callbacks posted from interrupts, pushed by interrupts and taken by the queue.
+   struct post
+   {
+      callback_obj_at* callback;
+      uint8_t lane;
+   };
+   spsc_queue<post, EVENT_QUEUE_POSTS> _posts;
    
-   event_queue() {
+   basic_event_queue() {
       reset();
    }
 
    void reset() {
-      _index = 0;
-      _size = 0;
+      _events.clear();
       _run = true;
    }
 
    bool running() {
       return _run;
    }
-   
-   // Get next index.
-   inline index_t next(const index_t& i) {
-      return (i + 1) % EVENTS_SIZE;
+
+   // Current number of events in queue.
+   index_t size() {
+      return _events.size();
    }
 
-   // Get prev index.
-   inline index_t prev(const index_t& i) {
-      return (i + (EVENTS_SIZE - 1)) % EVENTS_SIZE;
+   // Get event at position i from the front.
+   inline event& at(const index_t& i) {
+      return _events[i];
    }
 
-   // Run the event queue.
+   // Result of running the queue for a while.
+   struct run_result
+   {
+      uint32_t    dispatched; // Number of events dispatched.
+      bool        pending;    // True if there are events left in the queue.
+      timestamp_t next;       // When the next event is due, if pending.
+   };
+   
+   // Run the event queue until it is empty or stopped.
    void run()
    {
       _run = true;
-      while (_size and _run) {
+      while (_pending() and _run) {
          timestamp_t now = now_us();
-         if (before(now, now, _events[_index].when)) {
-            auto delay = min(timestamp_t(1000000), _events[_index].when - now);
-            delayMicroseconds(delay);
+         if (before(now, now, at(0).when)) {
+            idle_t::idle(now, at(0).when);
          }
          else {
-            auto event = _events[_index];
-            --_size;
-            _index = next(_index);
-            event(*this);
+            _dispatch(now, now);
          }
       }
 
@@ -129,22 +181,88 @@ struct event_queue
       }
    }
 
+   // Dispatch the next event if it is due, does not wait. Makes it possible to embed the queue in another loop.
+   run_result run_once()
+   {
+      uint32_t dispatched = 0;
+      if (_pending()) {
+         timestamp_t now = now_us();
+         if (not before(now, now, at(0).when)) {
+            _dispatch(now, now);
+            dispatched = 1;
+         }
+      }
+      return _result(dispatched);
+   }
+
+   // Dispatch events due before or at deadline, idling while waiting. Returns when the deadline has passed, the queue
+   // is empty or it is stopped. A stop stays in effect (also for later calls) until reset() or run(), so a stop from
+   // a callback or interrupt between run_for slices is not lost.
+   run_result run_until(const timestamp_t& deadline)
+   {
+      uint32_t dispatched = 0;
+      while (_pending() and _run) {
+         timestamp_t now = now_us();
+         timestamp_t limit = before(now, now, deadline) ? now : deadline;
+         if (not before(now, limit, at(0).when)) {
+            _dispatch(now, limit);
+            ++dispatched;
+         }
+         else if (before(now, now, deadline)) {
+            idle_t::idle(now, before(now, at(0).when, deadline) ? at(0).when : deadline);
+         }
+         else {
+            break;
+         }
+      }
+      return _result(dispatched);
+   }
+
+   // Dispatch events for duration, see run_until.
+   run_result run_for(const delay_t& duration)
+   {
+      return run_until(now_us() + duration);
+   }
+
+   // Make run and run_until return, see run_until.
    void stop()
    {
       _run = false;
    }
    
-   // Enqueue event into the event loop, if queue is full it will show error. Depending on what type timestamp_t is it
-   // may wrap (70 minutes on arduino uno and teensy32), add to that some lag in handling is also possible so deltas
-   // above 60 mins (3.6e9 us) is bad practice.
-   template<typename T> inline void enqueue_at(T callback, timestamp_t when) { _enqueue(callback, when); }
-   template<typename T> inline void enqueue_rel(T callback, timestamp_t delta) { _enqueue(callback, now_us() + delta); }
-   template<typename T> inline void enqueue_now(T callback) { _enqueue(callback, now_us()); }
+   // Enqueue event into the event loop, if queue is full it will show error. The callback can be a function pointer,
+   // callback object pointer or a functor/lambda (see fun_t), state captured in a lambda makes it possible to run
+   // several instances of the same handler at once without globals. Depending on what type timestamp_t is it
+   // may wrap (70 minutes with 32 bit timestamps, see TIMESTAMP_BITS), add to that some lag in handling is also
+   // possible so deltas above 60 mins (3.6e9 us) is bad practice. The lane should be below lanes, higher lanes are
+   // dispatched first when several events are due.
+   template<typename T> inline void enqueue_at(T callback, timestamp_t when, uint8_t lane=0)
+   {
+      _enqueue(callback, when, lane);
+   }
+   
+   template<typename T> inline void enqueue_rel(T callback, delay_t delta, uint8_t lane=0)
+   {
+      _enqueue(callback, now_us() + delta, lane);
+   }
+   
+   template<typename T> inline void enqueue_now(T callback, uint8_t lane=0)
+   {
+      _enqueue(callback, now_us(), lane);
+   }
 
+   // Post callback from an interrupt, it is enqueued as due now before the next dispatch (interrupts wake the queue
+   // when idling). This is the only call that is safe from interrupts. Returns false if too many posts are waiting.
+   bool post_isr(callback_obj_at* callback, uint8_t lane=0)
+   {
+      return _posts.push(post{ callback, lane });
+   }
+   
+   // Return true if callback is in the queue, functors need operator== (see inline_fun::eq).
    template<typename T> bool present(T callback)
    {
-      for (uint32_t i = 0; i < _size; ++i) {
-         if (_events[(i + _index) % EVENTS_SIZE].fun_eq(callback)) {
+      for (uint32_t i = 0; i < _events.size(); ++i) {
+         if (at(i).fun.eq(wrap(callback))) {
             return true;
          }
       }
@@ -153,41 +271,90 @@ struct event_queue
    
 private:
 
+   // Enqueue callbacks posted from interrupts, then return true if there are events.
+   inline bool _pending()
+   {
+      post p;
+      while (_posts.pop(p)) {
+         _enqueue(p.callback, now_us(), p.lane);
+      }
+      return not _events.empty();
+   }
+   
+   // Dispatch the next event, the front event is due (at limit), but a later due event in a higher lane goes first.
+   inline void _dispatch(const timestamp_t& now, const timestamp_t& limit)
+   {
+      auto event = _take(_next_due(now, limit));
+      EVENT_QUEUE_TRACE(true, event.lane);
+      event.fun(*this, event.when);
+      EVENT_QUEUE_TRACE(false, event.lane);
+   }
+   
+   // Return position (from front) of the event to dispatch next, see _dispatch. With one lane this is always the front.
+   inline index_t _next_due(const timestamp_t& now, const timestamp_t& limit)
+   {
+      index_t best = 0;
+      if (lanes > 1) {
+         for (index_t i = 1; i < _events.size() and at(best).lane < lanes - 1; ++i) {
+            auto& e = at(i);
+            if (before(now, limit, e.when)) {
+               break;
+            }
+            if (e.lane > at(best).lane) {
+               best = i;
+            }
+         }
+      }
+      return best;
+   }
+
+   inline run_result _result(uint32_t dispatched)
+   {
+      return run_result{dispatched, not _events.empty(), _events.empty() ? 0 : at(0).when};
+   }
+   
+   // Remove and return event at position i (from front), events in front of it are moved back one step.
+   inline event _take(index_t i)
+   {
+      event e = at(i);
+      for (; i > 0; --i) {
+         at(i) = at(i - 1);
+      }
+      _events.pop_front();
+      return e;
+   }
+   
    template<typename T>
-   void _enqueue(T fun,  uint32_t when)
+   void _enqueue(T fun, timestamp_t when, uint8_t lane)
    {
-      if (_size == EVENTS_SIZE) {
+      PROFILE_SCOPE("enqueue");
+      
+      if (_events.size() == capacity) {
          show_error(error::EVENT_QUEUE_FULL);
       }
       else {
-         // First insert in and then let it bubble up.
-
-         _size++;
+         // First insert at the back and then let it bubble up.
 
-         auto front_index = _index;
-         auto back_index = (_index + _size - 1) % EVENTS_SIZE;
-
-         auto& e = _events[back_index];
-         e.fun_set(fun);
+         event e;
+         e.fun.set(wrap(fun));
          e.when = when;
+         e.lane = lane < lanes ? lane : lanes - 1;
+         _events.push_back(e);
 
          timestamp_t now = now_us();
 
-         while (back_index != front_index) {
-            auto back_peek = prev(back_index);
-
-            if (before(now, _events[back_peek].when, _events[back_index].when)) {
-               break;
-            }
-            
-            // Swap index and peek to let it bubble up.
-            event e = _events[back_index];
-            _events[back_index] = _events[back_peek];
-            _events[back_peek] = e;
-
-            back_index = back_peek;
+         index_t i = _events.size() - 1;
+         while (i > 0 and not before(now, at(i - 1).when, e.when)) {
+            at(i) = at(i - 1);
+            --i;
          }
+         at(i) = e;
       }
    }
 };
 
+// The default event queue, set up by EVENTS_SIZE, EVENT_LANES and EVENT_QUEUE_IDLE.
+using event_queue = basic_event_queue<EVENTS_SIZE,
+                                      event_index_select<EVENTS_SIZE <= 255>::type,
+                                      EVENT_LANES,
+                                      EVENT_QUEUE_IDLE>;
@@ -0,0 +1,253 @@
+#pragma once
+
+//
+// Division free number formatting. Digits are written backwards ending at end and a pointer to the first char is
+// returned, two digits per step from a lookup table and dividing by 100 and 10000 with reciprocal multiplication (a
+// uint32 division is about 600 cycles on AVR, see lab/timeit.cpp). On AVR 64 bit arithmetic is library calls as slow
+// as the division, so it is kept out of the common paths.
+//
+
+#include <stdint.h>
+
+// Max number of float decimals.
+#define FORMAT_MAX_PRECISION 9
+
+// Buffer size that fits any value with ending zero (float max has 39 digits).
+#define FORMAT_BUF_SIZE 52
+
+const char FORMAT_DIGITS[] PROGMEM =
+   "00010203040506070809"
+   "10111213141516171819"
+   "20212223242526272829"
+   "30313233343536373839"
+   "40414243444546474849"
+   "50515253545556575859"
+   "60616263646566676869"
+   "70717273747576777879"
+   "80818283848586878889"
+   "90919293949596979899";
+
+// Write v (< 100) as two digits.
+inline char* format_2digits(char* end, uint8_t v)
+{
+   *--end = pgm_read_byte(FORMAT_DIGITS + 2 * v + 1);
+   *--end = pgm_read_byte(FORMAT_DIGITS + 2 * v);
+   return end;
+}
+
+// Write v (< 10000) as four digits.
+inline char* format_4digits(char* end, uint16_t v)
+{
+   uint16_t q = (uint32_t(v) * 5243) >> 19;  // v / 100, exact for v < 43699
+   end = format_2digits(end, v - q * 100);
+   return format_2digits(end, q);
+}
+
+// High 32 bits of a * b from four 16 x 16 bit products, without a 64 bit multiply.
+inline uint32_t format_mulhi32_split(uint32_t a, uint32_t b)
+{
+   uint16_t a1 = a >> 16;
+   uint16_t a0 = a;
+   uint16_t b1 = b >> 16;
+   uint16_t b0 = b;
+   uint32_t mid1 = uint32_t(a1) * b0 + ((uint32_t(a0) * b0) >> 16);
+   uint32_t mid2 = uint32_t(a0) * b1 + (mid1 & 0xffff);
+   return uint32_t(a1) * b1 + (mid1 >> 16) + (mid2 >> 16);
+}
+
+// High 32 bits of a * b.
+inline uint32_t format_mulhi32(uint32_t a, uint32_t b)
+{
+#ifdef __AVR__
+   return format_mulhi32_split(a, b);
+#else
+   return (uint64_t(a) * b) >> 32;
+#endif
+}
+
+// Write v with at least min_digits digits (zero padded).
+inline char* format_u32(char* end, uint32_t v, uint8_t min_digits=1)
+{
+   char* stop = end - min_digits;
+
+   while (v >= 10000) {
+      uint32_t q = format_mulhi32(v, 0xd1b71759) >> 13;  // v / 10000, exact for all uint32
+      end = format_4digits(end, v - q * 10000);
+      v = q;
+   }
+
+   uint16_t w = v;
+   if (w >= 100) {
+      uint16_t q = (uint32_t(w) * 5243) >> 19;
+      end = format_2digits(end, w - q * 100);
+      w = q;
+   }
+   if (w >= 10) {
+      end = format_2digits(end, w);
+   }
+   else {
+      *--end = '0' + w;
+   }
+
+   while (end > stop) {
+      *--end = '0';
+   }
+   return end;
+}
+
+inline char* format_i32(char* end, int32_t v)
+{
+   if (v >= 0) {
+      return format_u32(end, v);
+   }
+   end = format_u32(end, 0u - uint32_t(v));
+   *--end = '-';
+   return end;
+}
+
+// Large values cost one 64 bit division per 9 digits.
+inline char* format_u64(char* end, uint64_t v)
+{
+   while (v > 0xffffffff) {
+      uint64_t q = v / 1000000000;
+      end = format_u32(end, uint32_t(v - q * 1000000000), 9);
+      v = q;
+   }
+   return format_u32(end, v);
+}
+
+inline char* format_i64(char* end, int64_t v)
+{
+   if (v >= 0) {
+      return format_u64(end, v);
+   }
+   end = format_u64(end, 0u - uint64_t(v));
+   *--end = '-';
+   return end;
+}
+
+// Write x (not negative, below 2^64) with precision decimals and zeros extra low zero digits of the integer part, see
+// format_float. The integer part is held in uint_t.
+template<typename uint_t>
+inline char* format_fixed(char* end, double x, uint8_t precision, uint32_t scale, uint8_t zeros)
+{
+   uint_t ip = x;
+   uint32_t frac = 0;
+   if (zeros == 0) {
+      double f = (x - double(ip)) * scale;
+      frac = f;
+      double rest = f - frac;
+      bool odd = precision ? frac & 1 : ip & 1;
+      if (rest > 0.5 or (rest == 0.5 and odd)) {
+         if (++frac == scale) {
+            frac = 0;
+            ++ip;
+         }
+      }
+   }
+
+   if (precision) {
+      end = format_u32(end, frac, precision);
+      *--end = '.';
+   }
+   while (zeros--) {
+      *--end = '0';
+   }
+   return sizeof(uint_t) > 4 ? format_u64(end, ip) : format_u32(end, ip);
+}
+
+// Write v with precision decimals, rounded half to even like printf("%.*f"). This is exact on hosts where double has
+// more than 45 bits of mantissa (a float fraction times 10^9 fits), on AVR where double is float the last decimal can
+// be off. Values above 2^64 get zeros as low digits. Values below 2^31 are done in 32 bits.
+inline char* format_float(char* end, float v, uint8_t precision)
+{
+   bool neg = __builtin_signbit(v);
+
+   if (v != v or v - v != 0) {
+      const char* s = v != v ? "nan" : "inf";
+      for (int8_t i = 2; i >= 0; --i) {
+         *--end = s[i];
+      }
+   }
+   else {
+      if (precision > FORMAT_MAX_PRECISION) {
+         precision = FORMAT_MAX_PRECISION;
+      }
+      uint32_t scale = 1;
+      for (uint8_t i = 0; i < precision; ++i) {
+         scale *= 10;
+      }
+
+      double x = neg ? -double(v) : double(v);
+      uint8_t zeros = 0;
+      while (x >= 18446744073709551616.0) {
+         x /= 10;
+         ++zeros;
+      }
+
+      if (x < 2147483648.0) {
+         end = format_fixed<uint32_t>(end, x, precision, scale, zeros);
+      }
+      else {
+         end = format_fixed<uint64_t>(end, x, precision, scale, zeros);
+      }
+   }
+
+   if (neg) {
+      *--end = '-';
+   }
+   return end;
+}
+
+//
+// Compile time parsing of format strings with {} placeholders, see SERIAL_F in serial.hpp. The text between
+// placeholders are segments (one more segment than placeholders), described by start and length in the format string
+// so it can be printed without scanning it at runtime. Format strings can be at most 255 chars.
+//
+
+// Number of placeholders in fmt.
+constexpr uint8_t format_placeholders(const char* fmt)
+{
+   return *fmt == '\0' ? 0
+      : fmt[0] == '{' and fmt[1] == '}' ? 1 + format_placeholders(fmt + 2)
+      : format_placeholders(fmt + 1);
+}
+
+// Start of segment i.
+constexpr uint8_t format_segment_start(const char* fmt, uint8_t i, uint8_t pos=0)
+{
+   return i == 0 ? pos
+      : fmt[pos] == '{' and fmt[pos + 1] == '}' ? format_segment_start(fmt, i - 1, pos + 2)
+      : format_segment_start(fmt, i, pos + 1);
+}
+
+// Length of segment starting at pos.
+constexpr uint8_t format_segment_len(const char* fmt, uint8_t pos)
+{
+   return fmt[pos] == '\0' or (fmt[pos] == '{' and fmt[pos + 1] == '}') ? 0 : 1 + format_segment_len(fmt, pos + 1);
+}
+
+struct format_segment
+{
+   uint8_t start;
+   uint8_t len;
+};
+
+template<uint8_t size>
+struct format_segments
+{
+   format_segment segment[size];
+};
+
+template<uint8_t... I> struct format_indices {};
+
+template<uint8_t N, uint8_t... I> struct format_make_indices : format_make_indices<N - 1, N - 1, I...> {};
+
+template<uint8_t... I> struct format_make_indices<0, I...> { using type = format_indices<I...>; };
+
+// All segments of fmt, use as format_parse(fmt, format_make_indices<format_placeholders(fmt) + 1>::type()).
+template<uint8_t... I>
+constexpr format_segments<sizeof...(I)> format_parse(const char* fmt, format_indices<I...>)
+{
+   return {{ { format_segment_start(fmt, I), format_segment_len(fmt, format_segment_start(fmt, I)) }... }};
+}
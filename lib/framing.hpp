@@ -0,0 +1,48 @@
+#pragma once
+
+//
+// Framing of binary messages: COBS encoding (removes all zero bytes so a zero byte can end a frame) and CRC-8.
+//
+
+// CRC-8 (polynomial 0x07) of len bytes of data, continues from crc.
+uint8_t crc8(const uint8_t* data, uint16_t len, uint8_t crc=0)
+{
+   for (uint16_t i = 0; i < len; ++i) {
+      crc ^= data[i];
+      for (uint8_t b = 0; b < 8; ++b) {
+         crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+      }
+   }
+   return crc;
+}
+
+// Max COBS encoded size of len bytes.
+constexpr uint16_t cobs_max_size(uint16_t len)
+{
+   return len + len / 254 + 1;
+}
+
+// COBS encode len bytes of data into out (needs room for cobs_max_size(len) bytes), the ending zero byte is not
+// added. Returns encoded length.
+uint16_t cobs_encode(const uint8_t* data, uint16_t len, uint8_t* out)
+{
+   uint16_t code_index = 0;
+   uint16_t o = 1;
+   uint8_t code = 1;
+   for (uint16_t i = 0; i < len; ++i) {
+      if (data[i] == 0) {
+         out[code_index] = code;
+         code_index = o++;
+         code = 1;
+         continue;
+      }
+      out[o++] = data[i];
+      if (++code == 0xff) {
+         out[code_index] = code;
+         code_index = o++;
+         code = 1;
+      }
+   }
+   out[code_index] = code;
+   return o;
+}
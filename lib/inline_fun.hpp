@@ -0,0 +1,82 @@
+#pragma once
+
+//
+// Fixed size callable storage. Holds a function pointer, functor or lambda with small captures inline, without new
+// (std::function may allocate) and without virtual calls.
+//
+
+#include <string.h>
+
+template<typename signature, uint8_t size> struct inline_fun;
+
+template<typename R, typename... Args, uint8_t size>
+struct inline_fun<R(Args...), size>
+{
+   inline_fun() : _invoke(nullptr)
+   {
+      memset(_storage.data, 0, size);
+   }
+
+   // Store callable f. It needs to fit in size bytes and be trivially copyable (plain data captures and no destructor)
+   // since it is copied around with memcpy.
+   template<typename F>
+   void set(const F& f)
+   {
+      static_assert(sizeof(F) <= size, "callable does not fit in inline storage, capture less or increase size");
+      static_assert(alignof(F) <= alignof(storage_t), "callable needs stricter alignment than inline storage");
+      static_assert(__has_trivial_copy(F) and __has_trivial_destructor(F), "callable needs to be trivially copyable");
+      memset(_storage.data, 0, size);
+      memcpy(_storage.data, &f, sizeof(F));
+      _invoke = &invoke<F>;
+   }
+
+   // Return true if f is of the same type as the stored callable and compares equal to it. Function pointers and
+   // functors with operator== are compared with ==, empty functors are equal by type, lambdas with captures can't be
+   // compared.
+   template<typename F>
+   bool eq(const F& f) const
+   {
+      return _invoke == &invoke<F> and _equal(*reinterpret_cast<const F*>(_storage.data), f, 0);
+   }
+
+   explicit operator bool() const
+   {
+      return _invoke != nullptr;
+   }
+
+   inline R operator()(Args... args)
+   {
+      return _invoke(_storage.data, args...);
+   }
+
+private:
+
+   template<typename F>
+   static inline auto _equal(const F& a, const F& b, int) -> decltype(bool(a == b))
+   {
+      return a == b;
+   }
+
+   template<typename F>
+   static inline bool _equal(const F& a, const F& b, long)
+   {
+      static_assert(__is_empty(F), "callable with state needs operator== to be compared");
+      return true;
+   }
+
+   template<typename F>
+   static R invoke(void* data, Args... args)
+   {
+      return (*static_cast<F*>(data))(args...);
+   }
+
+   union storage_t {
+      uint8_t  data[size];
+      void*    align_ptr;
+      uint32_t align_u32;
+      float    align_float;
+   };
+
+   R (*_invoke)(void* data, Args... args);
+   storage_t _storage;
+};
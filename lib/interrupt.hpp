@@ -0,0 +1,77 @@
+#pragma once
+
+//
+// Pin interrupts with a context pointer. attachInterrupt only takes a plain function, so handlers are kept in a table
+// of slots and each slot gets a trampoline function generated at compile time that calls the handler with its context.
+// This lets objects (like several rotary encoders) handle interrupts on pins chosen at runtime.
+//
+
+#include "error.hpp"
+
+// Max number of attached interrupts.
+#ifndef INTERRUPT_SLOTS
+#define INTERRUPT_SLOTS 8
+#endif
+
+using interrupt_fun_t = void (*)(void* context);
+
+struct interrupt_slot
+{
+   interrupt_fun_t fun;
+   void* context;
+   pin_t pin;
+};
+
+interrupt_slot interrupt_slots[INTERRUPT_SLOTS];
+
+template<uint8_t slot>
+void interrupt_trampoline()
+{
+   interrupt_slots[slot].fun(interrupt_slots[slot].context);
+}
+
+// Return the trampoline for slot i.
+template<uint8_t slot=0>
+inline void (*interrupt_trampoline_for(uint8_t i))()
+{
+   return i == slot ? interrupt_trampoline<slot> : interrupt_trampoline_for<slot + 1>(i);
+}
+
+template<>
+inline void (*interrupt_trampoline_for<INTERRUPT_SLOTS>(uint8_t i))()
+{
+   return nullptr;
+}
+
+// Call fun(context) on interrupt on pin, mode as for attachInterrupt. Returns false if the pin has no interrupt, or
+// shows error and returns false if all slots are used.
+bool attach_interrupt(pin_t pin, interrupt_fun_t fun, void* context, int mode)
+{
+   if (digitalPinToInterrupt(pin) == NOT_AN_INTERRUPT) {
+      return false;
+   }
+   for (uint8_t i = 0; i < INTERRUPT_SLOTS; ++i) {
+      if (not interrupt_slots[i].fun) {
+         {
+            interrupt_lock lock;
+            interrupt_slots[i] = { fun, context, pin };
+         }
+         attachInterrupt(digitalPinToInterrupt(pin), interrupt_trampoline_for(i), mode);
+         return true;
+      }
+   }
+   show_error(error::INTERRUPT_SLOTS_FULL);
+   return false;
+}
+
+// Detach interrupt on pin and free its slot.
+void detach_interrupt(pin_t pin)
+{
+   for (uint8_t i = 0; i < INTERRUPT_SLOTS; ++i) {
+      if (interrupt_slots[i].fun and interrupt_slots[i].pin == pin) {
+         detachInterrupt(digitalPinToInterrupt(pin));
+         interrupt_lock lock;
+         interrupt_slots[i].fun = nullptr;
+      }
+   }
+}
@@ -0,0 +1,529 @@
+#pragma once
+
+//
+// The Arduino API on a host (Linux), for tests (see lib/test/mock.hpp) and for building firmware as a host executable
+// (BOARD=Native, see Native.mk). Time is either real or virtual, pins are values in memory that can be set from a
+// script of timed inputs (firing attached interrupts) and Serial emulates the baud rate and hw buffer, writing to
+// stdout or a pty.
+//
+// Only the Arduino API is here, lib/base.hpp is used on top of it like on a board.
+//
+// Built with NATIVE_MAIN this also provides main(), calling setup() and then loop() until the end time:
+//
+//   pendel/pendel-native -v -t 60 -i 2000000:12:1
+//
+//   -v             virtual time, time only moves when reading it (1 us per read), delaying or idling
+//   -t SECONDS     end the run at this (real or virtual) time
+//   -p             send and receive Serial through a pty (path printed on stderr) instead of stdout
+//   -i US:PIN:VAL  set input pin to value at time (repeatable)
+//   -s FILE        read inputs from file, one "US PIN VAL" per line
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <termios.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#define LOW 0
+#define HIGH 1
+
+#define OUTPUT 0
+#define INPUT 1
+#define INPUT_PULLUP 2
+
+#define RISING 0
+#define FALLING 1
+#define CHANGE 2
+
+#define PI 3.1415926535897932384626433832795
+
+using byte = uint8_t;
+
+// No separate program memory on host.
+#define PROGMEM
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t*>(addr))
+#define strlen_P strlen
+
+class __FlashStringHelper;
+#define F(str) (reinterpret_cast<const __FlashStringHelper*>(str))
+
+//
+// Time.
+//
+
+// Virtual time for deterministic runs. When enabled time only moves when delaying or idling, and with 1 us for each
+// read so busy waits finish.
+bool virtual_time = false;
+uint64_t virtual_us = 0;
+
+void mock_virtual_time(bool enable, uint64_t start=0)
+{
+   virtual_time = enable;
+   virtual_us = start;
+}
+
+// Time when the run ends (exit from main), 0 for never.
+uint64_t native_end_us = 0;
+
+void native_inputs_due(uint64_t now);
+void native_serial_due(uint64_t now);
+
+// Current time as 64 bits, all time reads go through here.
+uint64_t native_us64()
+{
+   uint64_t now64;
+   if (virtual_time) {
+      now64 = virtual_us++;
+   }
+   else {
+      static uint64_t start_us = 0;
+      timeval now;
+      ::gettimeofday(&now, 0);
+      now64 = now.tv_sec * 1000000 + now.tv_usec;
+      if (start_us == 0) {
+         start_us = now64;
+      }
+      now64 -= start_us;
+   }
+   native_inputs_due(now64);
+   native_serial_due(now64);
+   if (native_end_us and native_end_us <= now64) {
+      exit(0);
+   }
+   return now64;
+}
+
+uint32_t micros()
+{
+   return uint32_t(native_us64());
+}
+
+uint32_t millis()
+{
+   return uint32_t(native_us64() / 1000);
+}
+
+void delayMicroseconds(uint32_t delay)
+{
+   if (virtual_time) {
+      virtual_us += delay;
+      return;
+   }
+   usleep(delay);
+}
+
+void delay(uint32_t ms)
+{
+   delayMicroseconds(ms * 1000);
+}
+
+// Idle until delay has passed (or earlier), by jumping in virtual time or sleeping in real time (at most 1 ms to stay
+// responsive). Used by sleep_idle in lib/base.hpp.
+void native_idle(uint32_t delay)
+{
+   if (virtual_time) {
+      virtual_us += delay;
+      return;
+   }
+   delayMicroseconds(std::min(delay, uint32_t(1000)));
+}
+
+//
+// Pins and interrupts.
+//
+
+std::vector<uint8_t> pin_modes(256);
+std::vector<uint8_t> pin_values(256);
+std::vector<uint16_t> analog_values(256);
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+   pin_modes[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+   pin_values[pin] = value & 1;
+}
+
+uint8_t digitalRead(uint8_t pin)
+{
+   return pin_values[pin] & 1;
+}
+
+int analogRead(uint8_t pin)
+{
+   return analog_values[pin];
+}
+
+void analogWrite(uint8_t pin, int value)
+{
+   analog_values[pin] = value;
+}
+
+// As ::map where std::map is in scope (the lib has "using namespace std").
+long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+   return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+// No interrupts on host, handlers are called synchronously.
+void noInterrupts() {}
+void interrupts() {}
+
+#define NOT_AN_INTERRUPT -1
+
+// Interrupts are numbered as pins, pins from 200 have no interrupt. mock_input calls the attached handler.
+int digitalPinToInterrupt(uint8_t pin)
+{
+   return pin < 200 ? pin : NOT_AN_INTERRUPT;
+}
+
+std::vector<void (*)(void)> interrupt_handlers(256);
+std::vector<int> interrupt_modes(256);
+
+void attachInterrupt(uint8_t pin, void (*func)(void), int mode)
+{
+   interrupt_handlers[pin] = func;
+   interrupt_modes[pin] = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+   interrupt_handlers[pin] = nullptr;
+}
+
+// Set input pin value and call the interrupt handler if attached and the change matches the mode.
+void mock_input(uint8_t pin, uint8_t value)
+{
+   uint8_t old = pin_values[pin];
+   pin_values[pin] = value & 1;
+   if (interrupt_handlers[pin] and old != pin_values[pin]
+       and (interrupt_modes[pin] == CHANGE
+            or (interrupt_modes[pin] == RISING and pin_values[pin])
+            or (interrupt_modes[pin] == FALLING and not pin_values[pin]))) {
+      interrupt_handlers[pin]();
+   }
+}
+
+// Each pin is a port of its own with the value in bit 0.
+#define digitalPinToPort(pin) (pin)
+#define digitalPinToBitMask(pin) (1)
+#define portInputRegister(port) (&pin_values[port])
+
+// Scripted input, pin is set to value (with mock_input) when time reaches at.
+struct native_input
+{
+   uint64_t at;
+   uint8_t pin;
+   uint8_t value;
+};
+
+std::deque<native_input> native_inputs;
+
+// Add input to the script, inputs at the same time are applied in the order added.
+void native_script_input(uint64_t at, uint8_t pin, uint8_t value)
+{
+   auto pos = std::upper_bound(native_inputs.begin(), native_inputs.end(), at,
+                               [](uint64_t at, const native_input& input) { return at < input.at; });
+   native_inputs.insert(pos, native_input{at, pin, value});
+}
+
+// Apply inputs due at now, like interrupts arriving between instructions.
+void native_inputs_due(uint64_t now)
+{
+   while (not native_inputs.empty() and native_inputs.front().at <= now) {
+      native_input input = native_inputs.front();
+      native_inputs.pop_front();
+      mock_input(input.pin, input.value);
+   }
+}
+
+//
+// Serial.
+//
+
+// Serial with emulated baud rate and hw send buffer. Written bytes leave the hw buffer at the baud rate (10 bits per
+// byte, instantly if baud rate is 0) and end up in output (if record), on echo_fd if set and in the pty if opened.
+// Bytes leave as time passes, like on a board. Writing more than there is room for blocks, by sleeping or moving
+// virtual time.
+struct mock_serial
+{
+   mock_serial() : hw_size(64), baud_rate(0), record(true), echo_fd(-1), _last_us(0), _pty(-1) {}
+
+   // Reset buffers and set hw buffer size.
+   void reset(uint32_t hw_size=64)
+   {
+      this->hw_size = hw_size;
+      output.clear();
+      input.clear();
+      _hw.clear();
+      _last_us = native_us64();
+   }
+
+   // Open a pty that receives output and provides input, returns the path to attach to (like make console PORT=path).
+   const char* open_pty()
+   {
+      _pty = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+      if (_pty < 0 or grantpt(_pty) or unlockpt(_pty)) {
+         return nullptr;
+      }
+      const char* path = ptsname(_pty);
+      int slave = open(path, O_RDWR | O_NOCTTY);
+      termios tio;
+      tcgetattr(slave, &tio);
+      cfmakeraw(&tio);
+      tcsetattr(slave, TCSANOW, &tio);
+      close(slave);
+      return path;
+   }
+
+   void close_pty()
+   {
+      if (_pty >= 0) {
+         close(_pty);
+         _pty = -1;
+      }
+   }
+
+   void begin(uint32_t baud_rate)
+   {
+      this->baud_rate = baud_rate;
+      _last_us = native_us64();
+   }
+
+   void end() {}
+
+   // Wait for hw buffer to be sent.
+   void flush()
+   {
+      while (availableForWrite() < int(hw_size)) {
+         delayMicroseconds(_byte_us());
+      }
+   }
+
+   int availableForWrite()
+   {
+      _drain();
+      return hw_size - _hw.size();
+   }
+
+   size_t write(uint8_t c)
+   {
+      while (availableForWrite() <= 0) {
+         delayMicroseconds(_byte_us());
+      }
+      _hw.push_back(c);
+      _drain();
+      return 1;
+   }
+
+   size_t write(const uint8_t* data, size_t len)
+   {
+      for (size_t i = 0; i < len; ++i) {
+         write(data[i]);
+      }
+      return len;
+   }
+
+   size_t write(const char* data, size_t len)
+   {
+      return write(reinterpret_cast<const uint8_t*>(data), len);
+   }
+
+   template<typename T>
+   size_t print(T value)
+   {
+      std::ostringstream os;
+      os << value;
+      return write(os.str().data(), os.str().size());
+   }
+
+   size_t print(float value)
+   {
+      std::ostringstream os;
+      os << std::fixed << std::setprecision(2) << value;
+      return write(os.str().data(), os.str().size());
+   }
+
+   template<typename T>
+   size_t println(T value)
+   {
+      return print(value) + write("\r\n", 2);
+   }
+
+   int available()
+   {
+      if (_pty >= 0) {
+         uint8_t buf[64];
+         ssize_t n;
+         while ((n = ::read(_pty, buf, sizeof(buf))) > 0) {
+            input.insert(input.end(), buf, buf + n);
+         }
+      }
+      return input.size();
+   }
+
+   int read()
+   {
+      if (available() == 0) {
+         return -1;
+      }
+      int c = input.front();
+      input.pop_front();
+      return c;
+   }
+
+   // Move bytes sent at now from hw buffer to output.
+   void drain_until(uint64_t now)
+   {
+      while (not _hw.empty() and (baud_rate == 0 or _last_us + _byte_us() <= now)) {
+         uint8_t c = _hw.front();
+         _hw.pop_front();
+         if (record) {
+            output.push_back(c);
+         }
+         if (echo_fd >= 0) {
+            ::write(echo_fd, &c, 1);
+         }
+         if (_pty >= 0) {
+            ::write(_pty, &c, 1);
+         }
+         _last_us += _byte_us();
+      }
+      if (_hw.empty()) {
+         _last_us = now;
+      }
+   }
+
+   uint32_t hw_size;
+   uint32_t baud_rate;
+   bool record;
+   int echo_fd;
+   std::string output;
+   std::deque<uint8_t> input;
+
+private:
+
+   uint32_t _byte_us()
+   {
+      return baud_rate ? std::max(uint32_t(1), 10 * 1000000 / baud_rate) : 1;
+   }
+
+   void _drain()
+   {
+      drain_until(native_us64());
+   }
+
+   std::deque<uint8_t> _hw;
+   uint64_t _last_us;
+   int _pty;
+};
+
+mock_serial Serial;
+
+void native_serial_due(uint64_t now)
+{
+   Serial.drain_until(now);
+}
+
+//
+// Main.
+//
+
+#ifdef NATIVE_MAIN
+
+void setup();
+void loop();
+
+void native_usage(const char* name)
+{
+   fprintf(stderr, "usage: %s [-v] [-t SECONDS] [-p] [-i US:PIN:VALUE]... [-s FILE]\n", name);
+   exit(2);
+}
+
+// Read inputs from file, one "US PIN VALUE" per line.
+void native_read_script(const char* path)
+{
+   FILE* file = fopen(path, "r");
+   if (not file) {
+      perror(path);
+      exit(1);
+   }
+   unsigned long long at;
+   unsigned pin;
+   unsigned value;
+   while (fscanf(file, "%llu %u %u", &at, &pin, &value) == 3) {
+      native_script_input(at, pin, value);
+   }
+   fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+   bool pty = false;
+   int opt;
+   while ((opt = getopt(argc, argv, "vt:pi:s:")) != -1) {
+      switch (opt) {
+         case 'v':
+            mock_virtual_time(true);
+            break;
+         case 't':
+            native_end_us = uint64_t(atof(optarg) * 1e6);
+            break;
+         case 'p':
+            pty = true;
+            break;
+         case 'i': {
+            unsigned long long at;
+            unsigned pin;
+            unsigned value;
+            if (sscanf(optarg, "%llu:%u:%u", &at, &pin, &value) != 3) {
+               native_usage(argv[0]);
+            }
+            native_script_input(at, pin, value);
+            break;
+         }
+         case 's':
+            native_read_script(optarg);
+            break;
+         default:
+            native_usage(argv[0]);
+      }
+   }
+
+   // Nothing reads the output, so don't keep it.
+   Serial.record = false;
+   if (pty) {
+      const char* path = Serial.open_pty();
+      if (not path) {
+         perror("pty");
+         return 1;
+      }
+      fprintf(stderr, "serial on %s\n", path);
+   }
+   else {
+      Serial.echo_fd = STDOUT_FILENO;
+   }
+
+   setup();
+   while (true) {
+      loop();
+   }
+}
+
+#endif
@@ -0,0 +1,207 @@
+#pragma once
+
+//
+// Registry of named numeric parameters that can be read and set at runtime over serial, for tuning without
+// re-flashing. Commands, one per line:
+//
+//   list                 print all parameters and values
+//   get <name>           print value of parameter
+//   set <name> <value>   set parameter and print the new value
+//
+
+#include <errno.h>
+#include <float.h>
+
+#include "containers.hpp"
+#include "event_queue.hpp"
+#include "serial.hpp"
+#include "util.hpp"
+
+#ifndef PARAMS_SIZE
+#define PARAMS_SIZE 16
+#endif
+
+struct params : event_queue::callback_obj_at
+{
+   params(event_queue& event_queue, noblock_serial& serial, const delay_t& interval=20 * MILLIS) :
+      _event_queue(event_queue), _serial(serial), _interval(interval)
+   {}
+
+   // Register parameter, name and value need to live as long as the registry.
+   void add(const char* name, float& value)    { _add(name, FLOAT, &value); }
+   void add(const char* name, int32_t& value)  { _add(name, INT32, &value); }
+   void add(const char* name, uint32_t& value) { _add(name, UINT32, &value); }
+   void add(const char* name, int16_t& value)  { _add(name, INT16, &value); }
+   void add(const char* name, uint16_t& value) { _add(name, UINT16, &value); }
+
+   // Set parameter from string, returns false if there is no parameter name, value is not a number or it is out of
+   // range for the parameter type (then the parameter is left as is).
+   bool set(const char* name, const char* value)
+   {
+      param* param = _find(name);
+      if (not param or not *value) {
+         return false;
+      }
+
+      char* end;
+      errno = 0;
+      if (param->type == FLOAT) {
+         double v = strtod(value, &end);
+         if (*end or errno or v > FLT_MAX or v < -FLT_MAX) {
+            return false;
+         }
+         *static_cast<float*>(param->value) = v;
+         return true;
+      }
+
+      if (param->type == UINT32 or param->type == UINT16) {
+         // strtoul wraps negative values.
+         unsigned long v = strtoul(value, &end, 10);
+         unsigned long max = param->type == UINT32 ? 0xfffffffful : 0xfffful;
+         if (*end or errno or *value == '-' or v > max) {
+            return false;
+         }
+         if (param->type == UINT32) {
+            *static_cast<uint32_t*>(param->value) = v;
+         }
+         else {
+            *static_cast<uint16_t*>(param->value) = v;
+         }
+         return true;
+      }
+
+      long v = strtol(value, &end, 10);
+      long min = param->type == INT32 ? -2147483647L - 1 : -32768L;
+      long max = param->type == INT32 ? 2147483647L : 32767L;
+      if (*end or errno or v < min or v > max) {
+         return false;
+      }
+      if (param->type == INT32) {
+         *static_cast<int32_t*>(param->value) = v;
+      }
+      else {
+         *static_cast<int16_t*>(param->value) = v;
+      }
+      return true;
+   }
+
+   // Print parameter as "name value\n", returns false if there is no parameter name.
+   bool print(const char* name)
+   {
+      param* param = _find(name);
+      if (not param) {
+         return false;
+      }
+      _print(*param);
+      return true;
+   }
+
+   // Handle a command line (modified while parsing).
+   void command(char* line)
+   {
+      char* cmd = _token(line);
+      char* name = _token(line);
+      char* value = _token(line);
+
+      if (strcmp(cmd, "list") == 0) {
+         for (const param& p : _params) {
+            _print(p);
+         }
+      }
+      else if (strcmp(cmd, "get") == 0) {
+         if (not print(name)) {
+            _serial.p("no param ", name, "\n");
+         }
+      }
+      else if (strcmp(cmd, "set") == 0) {
+         if (not set(name, value)) {
+            _serial.p("failed to set ", name, "\n");
+         }
+         else {
+            print(name);
+         }
+      }
+      else {
+         _serial.p("unknown command ", cmd, ", use list, get <name> or set <name> <value>\n");
+      }
+   }
+
+   // Start polling serial for commands.
+   void start()
+   {
+      if (not _event_queue.present(this)) {
+         _event_queue.enqueue_now(this);
+      }
+   }
+
+   void operator()(event_queue& eq, const timestamp_t& when) override
+   {
+      char* line;
+      while ((line = _serial.read_line())) {
+         command(line);
+      }
+      eq.enqueue_at(this, when + _interval);
+   }
+
+private:
+
+   enum type_t : uint8_t { FLOAT, INT32, UINT32, INT16, UINT16 };
+
+   struct param
+   {
+      const char* name;
+      type_t type;
+      void* value;
+   };
+
+   void _add(const char* name, type_t type, void* value)
+   {
+      if (not _params.push_back(param{ name, type, value })) {
+         show_error(error::PARAMS_FULL);
+      }
+   }
+
+   param* _find(const char* name)
+   {
+      for (param& p : _params) {
+         if (strcmp(p.name, name) == 0) {
+            return &p;
+         }
+      }
+      return nullptr;
+   }
+
+   void _print(const param& param)
+   {
+      _serial.p(param.name, " ");
+      switch (param.type) {
+         case FLOAT:  _serial.p(*static_cast<float*>(param.value)); break;
+         case INT32:  _serial.p(*static_cast<int32_t*>(param.value)); break;
+         case UINT32: _serial.p(*static_cast<uint32_t*>(param.value)); break;
+         case INT16:  _serial.p(*static_cast<int16_t*>(param.value)); break;
+         case UINT16: _serial.p(*static_cast<uint16_t*>(param.value)); break;
+      }
+      _serial.p("\n");
+   }
+
+   // Return next space separated token in line (zero terminated in place) and move line past it, empty string at end.
+   static char* _token(char*& line)
+   {
+      while (*line == ' ') {
+         ++line;
+      }
+      char* token = line;
+      while (*line and *line != ' ') {
+         ++line;
+      }
+      if (*line) {
+         *line++ = '\0';
+      }
+      return token;
+   }
+
+   event_queue& _event_queue;
+   noblock_serial& _serial;
+   delay_t _interval;
+   static_vector<param, PARAMS_SIZE> _params;
+};
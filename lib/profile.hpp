@@ -0,0 +1,157 @@
+#pragma once
+
+//
+// Scoped profiling of code sites, min, max, mean and count of the time spent in a scope is accumulated per site:
+//
+//   void run(...)
+//   {
+//      PROFILE_SCOPE("run");
+//      ...
+//   }
+//
+//   profile_dump(serial);
+//
+// Time is measured in cpu cycles on arm (DWT cycle counter, F_CPU per second), micro seconds on avr and nano seconds
+// on host. Sites are registered in a list on first use and lives in static storage. PROFILE_SCOPE does nothing unless
+// built with PROFILE_ENABLED=1, so it can be left in place in lib code (see event_queue.hpp and stepper.hpp).
+//
+
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 0
+#endif
+
+#if defined(__arm__)
+
+#define PROFILE_UNIT "cycles"
+
+#define PROFILE_DEMCR      (*(volatile uint32_t*) 0xe000edfc)
+#define PROFILE_DWT_CTRL   (*(volatile uint32_t*) 0xe0001000)
+#define PROFILE_DWT_CYCCNT (*(volatile uint32_t*) 0xe0001004)
+
+// Enable the cycle counter (trace enable in DEMCR, then CYCCNTENA in DWT_CTRL).
+inline void profile_init()
+{
+   PROFILE_DEMCR |= 1ul << 24;
+   PROFILE_DWT_CTRL |= 1;
+}
+
+inline uint32_t profile_now() { return PROFILE_DWT_CYCCNT; }
+
+#elif defined(__AVR__)
+
+#define PROFILE_UNIT "us"
+
+inline void profile_init() {}
+
+inline uint32_t profile_now() { return micros(); }
+
+#else
+
+// Monotonic clock from time.h rather than <chrono>, that would bring std::tm into scope with "using namespace std"
+// and clash with globals named tm.
+#include <time.h>
+
+#define PROFILE_UNIT "ns"
+
+inline void profile_init() {}
+
+inline uint32_t profile_now()
+{
+   timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return uint32_t(uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec);
+}
+
+#endif
+
+struct profile_site;
+
+// First registered site.
+profile_site* profile_sites = nullptr;
+
+struct profile_site
+{
+   // Name needs to live as long as the site.
+   profile_site(const char* name) : name(name), next(nullptr)
+   {
+      reset();
+      profile_init();
+      profile_site** last = &profile_sites;
+      while (*last) {
+         last = &(*last)->next;
+      }
+      *last = this;
+   }
+
+   inline void add(uint32_t duration)
+   {
+      ++count;
+      total += duration;
+      if (duration < min) {
+         min = duration;
+      }
+      if (duration > max) {
+         max = duration;
+      }
+   }
+
+   uint32_t mean() const
+   {
+      return count ? total / count : 0;
+   }
+
+   void reset()
+   {
+      count = 0;
+      total = 0;
+      min = 0xffffffff;
+      max = 0;
+   }
+
+   const char* name;
+   profile_site* next;
+   uint32_t count;
+   uint64_t total;
+   uint32_t min;
+   uint32_t max;
+};
+
+// Measure time from construction to destruction into site.
+struct profile_scope
+{
+   inline profile_scope(profile_site& site) : _site(site), _start(profile_now()) {}
+
+   inline ~profile_scope() { _site.add(profile_now() - _start); }
+
+private:
+   profile_site& _site;
+   uint32_t _start;
+};
+
+#define PROFILE_CAT_(a, b) a##b
+#define PROFILE_CAT(a, b) PROFILE_CAT_(a, b)
+
+#if PROFILE_ENABLED
+#define PROFILE_SCOPE(name)                                                           \
+   static profile_site PROFILE_CAT(_profile_site_, __LINE__)(name);                  \
+   profile_scope PROFILE_CAT(_profile_scope_, __LINE__)(PROFILE_CAT(_profile_site_, __LINE__))
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+// Print one line per site, "<name> count <n> min <t> mean <t> max <t> <unit>", to a noblock_serial.
+template<typename serial_t>
+void profile_dump(serial_t& serial)
+{
+   for (profile_site* site = profile_sites; site; site = site->next) {
+      serial.p(site->name, " count ", site->count, " min ", site->count ? site->min : 0, " mean ", site->mean(),
+               " max ", site->max, " " PROFILE_UNIT "\n");
+   }
+}
+
+void profile_reset()
+{
+   for (profile_site* site = profile_sites; site; site = site->next) {
+      site->reset();
+   }
+}
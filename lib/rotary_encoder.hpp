@@ -1,41 +1,169 @@
 #pragma once
 
 //
-// Interface for rotary, encoder_a which should be an interrupt port, and encoder_b which does not need to be, and then
-// ticks per revolution.
+// Interface for rotary, ticks per revolution (in the decoding mode, X4 gives twice the ticks of X2 for the same
+// encoder), and pins at construction, encoder_a which should be an interrupt port, and encoder_b which needs to be one
+// too for X4 decoding. State is per instance so several encoders can be used, each takes one (X2) or two (X4) slots in
+// lib/interrupt.hpp.
 //
-template<pin_t encoder_a, pin_t encoder_b, uint16_t rev_tics=1024>
+// With edges > 0 the last edges (a power of two) are timestamped in the interrupt, and velocity() estimates speed from
+// edge periods, which is much less quantized than a count difference per control tick at low speed.
+//
+// With an index (Z) pin, see index(), the raw angle is set to a known value on the first index pulse, so no other
+// reference is needed, and count errors (missed edges) are corrected on every revolution.
+//
+// Noise is rejected in the interrupt, edges that are not a legal quadrature transition are counted in invalid(), and
+// with filter() pulses on a channel shorter than a minimum interval are dropped (the step of the first edge is taken
+// back on the second) and counted in glitches(). The cost is one micros() call per edge, shared with edge timestamps.
+//
+
+#include "interrupt.hpp"
+
+// Decoding mode, X2 counts both edges of channel A, X4 counts both edges of both channels.
+enum class encoder_mode : uint8_t
+{
+   X2,
+   X4,
+};
+
+// Quadrature transitions indexed by previous state << 2 | new state, where state is a << 1 | b, -1 or 1 for a step
+// and ENCODER_INVALID when both channels changed (a missed edge, direction unknown).
+#define ENCODER_INVALID 2
+
+// Velocity is calculated over edges within this window (us) before the last edge, at least the last period.
+#ifndef ENCODER_VELOCITY_WINDOW
+#define ENCODER_VELOCITY_WINDOW 10000
+#endif
+
+// Velocity is 0 if no edge within this time (us).
+#ifndef ENCODER_VELOCITY_TIMEOUT
+#define ENCODER_VELOCITY_TIMEOUT 200000
+#endif
+
+// No index pin.
+constexpr pin_t ENCODER_NO_PIN = 0xff;
+
+// Index pulses within this many ticks of the expected raw angle are not corrected, the pulse edge is seen at slightly
+// different angles depending on direction.
+#ifndef ENCODER_INDEX_TOLERANCE
+#define ENCODER_INDEX_TOLERANCE 1
+#endif
+
+// Memory barrier for the seqlock between interrupt and readers.
+#define ENCODER_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+// Consistent state of the encoder, when is the time of the last edge (micros) if edges are timestamped, otherwise 0.
+struct encoder_snapshot
+{
+   ang_t raw;
+   int32_t lap;
+   uint32_t when;
+};
+
+const int8_t ENCODER_TRANSITIONS[16] PROGMEM = {
+   0, -1,  1,  2,
+   1,  0,  2, -1,
+  -1,  2,  0,  1,
+   2,  1, -1,  0,
+};
+
+template<uint16_t rev_tics=1024, encoder_mode mode=encoder_mode::X2, uint8_t edges=0>
 struct rotary_encoder
 {
+   static_assert((edges & (edges - 1)) == 0, "edges needs to be a power of two");
+
    // Init the encoder.
-   rotary_encoder()
+   rotary_encoder(pin_t encoder_a, pin_t encoder_b) :
+      _encoder_a(encoder_a), _encoder_b(encoder_b), _encoder_z(ENCODER_NO_PIN), _raw(0), _lap(0), _seq(0), _invalid(0),
+      _glitches(0), _min_interval(0), _channel_edge(), _channel_step(), _last_channel(NO_CHANNEL), _count(0), _edges(),
+      _edge_index(0), _edge_fill(0), _index_raw(0), _index_error(0), _indexed(false)
    {
-      pinMode(13, OUTPUT);
       pinMode(encoder_a, INPUT);
       pinMode(encoder_b, INPUT);
-      attachInterrupt(digitalPinToInterrupt(encoder_a), 
-                      interrupt, 
-                      CHANGE);
-      reset();
+      _a_reg = portInputRegister(digitalPinToPort(encoder_a));
+      _a_mask = digitalPinToBitMask(encoder_a);
+      _b_reg = portInputRegister(digitalPinToPort(encoder_b));
+      _b_mask = digitalPinToBitMask(encoder_b);
+      _state = _read();
+      if (mode == encoder_mode::X4) {
+         attach_interrupt(encoder_a, _interrupt_x4, this, CHANGE);
+         attach_interrupt(encoder_b, _interrupt_x4, this, CHANGE);
+      }
+      else {
+         attach_interrupt(encoder_a, _interrupt_x2, this, CHANGE);
+      }
+   }
+
+   // The interrupt refers to the instance.
+   rotary_encoder(const rotary_encoder&) = delete;
+   rotary_encoder& operator=(const rotary_encoder&) = delete;
+
+   // Use index pulse on pin encoder_z, which is at raw angle index_raw. To find index_raw, use 0, reference some other
+   // way (like reset in a known position) and read index_error() after the first pulse.
+   void index(pin_t encoder_z, ang_t index_raw)
+   {
+      pinMode(encoder_z, INPUT);
+      _encoder_z = encoder_z;
+      _index_raw = index_raw;
+      attach_interrupt(encoder_z, _interrupt_z, this, RISING);
+   }
+
+   // Drop pulses on a channel shorter than min_interval us, 0 to disable (the default). Should be well below the edge
+   // period at max speed.
+   void filter(uint16_t min_interval)
+   {
+      _min_interval = min_interval;
+   }
+   
+   // Return true if an index pulse has set the raw angle.
+   bool indexed()
+   {
+      return _indexed;
+   }
+
+   // Return raw angle at the last index pulse relative to the index_raw (the correction made if outside tolerance).
+   ang_t index_error()
+   {
+      interrupt_lock lock;
+      return _index_error;
    }
 
    // Set the current raw angle value and lap value to 0 and thus make it reference.
    void reset(int16_t raw=0, int32_t lap=0)
    {
+      interrupt_lock lock;
       _raw = raw;
       _lap = lap;
    }
 
+   // Return raw, lap and time of last edge consistent with each other. The interrupt updates under a sequence number
+   // (odd while updating), so reading is retried if an interrupt happened while reading, interrupts are never
+   // disabled.
+   encoder_snapshot snapshot()
+   {
+      encoder_snapshot s;
+      uint8_t seq;
+      do {
+         seq = _seq;
+         ENCODER_BARRIER();
+         s.raw = _raw;
+         s.lap = _lap;
+         s.when = edges ? _edges[uint8_t(_edge_index - 1) & (edges - 1)].when : 0;
+         ENCODER_BARRIER();
+      } while ((seq & 1) or seq != _seq);
+      return s;
+   }
+   
    // Return the raw angle value.
    ang_t raw()
    {
-      return _raw;
+      return snapshot().raw;
    }
 
    // Return the lap value.
    int32_t lap()
    {
-      return _lap;
+      return snapshot().lap;
    }
    
    // Return the relative angle between ang and ref (ang - ref). The return value will be in the range [-rev_tics/2,
@@ -50,18 +178,149 @@ struct rotary_encoder
    // rev_tics/2).
    inline ang_t ang(ang_t ref=0) 
    {
-      return rel(_raw, ref);
+      return rel(raw(), ref);
+   }
+
+   // Return angular speed in ticks per second from edge timestamps (needs edges > 1). Uses the edges within
+   // ENCODER_VELOCITY_WINDOW before the last edge, which at low speed is the last edge period (1/T) and at high speed a
+   // count difference over the window (or all stored edges). The result is limited to one tick since the last edge, so
+   // it falls off when edges stop.
+   float velocity(uint32_t now)
+   {
+      static_assert(edges > 1, "velocity needs edge timestamps, set edges");
+      
+      edge last;
+      edge first;
+      uint8_t fill;
+      {
+         interrupt_lock lock;
+         fill = _edge_fill;
+         last = _edges[uint8_t(_edge_index - 1) & (edges - 1)];
+         first = _edges[uint8_t(_edge_index - 2) & (edges - 1)];
+         for (uint8_t i = 3; i <= fill; ++i) {
+            const edge& e = _edges[uint8_t(_edge_index - i) & (edges - 1)];
+            if (last.when - e.when > ENCODER_VELOCITY_WINDOW) {
+               break;
+            }
+            first = e;
+         }
+      }
+
+      uint32_t since = now - last.when;
+      if (fill < 2 or since > ENCODER_VELOCITY_TIMEOUT) {
+         return 0;
+      }
+      
+      uint32_t period = last.when - first.when;
+      float v = float(last.count - first.count) * 1e6f / (period ? period : 1);
+      float bound = 1e6f / (since ? since : 1);
+      return v > bound ? bound : v < -bound ? -bound : v;
+   }
+   
+   // Return the number of invalid transitions, when both channels changed between interrupts (X4) or channel a did not
+   // change (X2).
+   uint32_t invalid()
+   {
+      interrupt_lock lock;
+      return _invalid;
    }
 
-   virtual ~rotary_encoder() {}
+   // Return the number of pulses dropped by filter.
+   uint32_t glitches()
+   {
+      interrupt_lock lock;
+      return _glitches;
+   }
+
+   virtual ~rotary_encoder()
+   {
+      detach_interrupt(_encoder_a);
+      if (mode == encoder_mode::X4) {
+         detach_interrupt(_encoder_b);
+      }
+      if (_encoder_z != ENCODER_NO_PIN) {
+         detach_interrupt(_encoder_z);
+      }
+   }
 
 private:
 
-   static void interrupt()
+   // Read channels as a << 1 | b.
+   inline uint8_t _read()
+   {
+      return (*_a_reg & _a_mask ? 2 : 0) | (*_b_reg & _b_mask ? 1 : 0);
+   }
+
+   struct edge
+   {
+      uint32_t when;
+      int32_t count;
+   };
+   
+   // Count step d made by an edge on channel ch (0 for a, 1 for b), or if the edge ends a pulse shorter than
+   // min_interval on the channel, take back the step made by the pulse start and count a glitch.
+   inline void _edge(uint8_t ch, int8_t d, uint32_t now)
+   {
+      int8_t start = _channel_step[ch];
+      bool glitch = _min_interval and start and now - _channel_edge[ch] < _min_interval;
+      _channel_edge[ch] = now;
+      _channel_step[ch] = glitch ? 0 : d;
+      if (not glitch) {
+         _last_channel = ch;
+         _step(d, now);
+         return;
+      }
+      
+      ++_glitches;
+      if (_last_channel == ch) {
+         // Nothing happened on the other channel during the pulse, as if it never was.
+         _take_back(start);
+      }
+      else {
+         _step(-start, now);
+      }
+      _last_channel = NO_CHANNEL;
+   }
+   
+   inline void _step(int8_t d, uint32_t now)
+   {
+      ++_seq;
+      ENCODER_BARRIER();
+      
+      _move(d);
+      if (edges) {
+         edge& e = _edges[_edge_index++ & (edges - 1)];
+         e.when = now;
+         e.count = _count;
+         if (_edge_fill < edges) {
+            ++_edge_fill;
+         }
+      }
+
+      ENCODER_BARRIER();
+      ++_seq;
+   }
+
+   // Undo the last step d including its edge timestamp.
+   inline void _take_back(int8_t d)
+   {
+      ++_seq;
+      ENCODER_BARRIER();
+      
+      _move(-d);
+      if (edges) {
+         --_edge_index;
+         --_edge_fill;
+      }
+
+      ENCODER_BARRIER();
+      ++_seq;
+   }
+   
+   inline void _move(int8_t d)
    {
-      bool a = digitalRead(encoder_a);
-      bool b = digitalRead(encoder_b);
-      if (a == b) {
+      _count += d;
+      if (d < 0) {
          --_raw;
          if (_raw == -1) {
             _raw = rev_tics - 1;
@@ -77,12 +336,104 @@ private:
       }
    }
 
-   static volatile ang_t   _raw;
-   static volatile int32_t _lap;
-};
+   // Move raw to index_raw the shortest way (adjusting lap if passing 0) on first pulse or if off by more than the
+   // tolerance.
+   static void _interrupt_z(void* context)
+   {
+      auto self = static_cast<rotary_encoder*>(context);
+      ang_t error = self->rel(self->_raw, self->_index_raw);
+      self->_index_error = error;
+      if (self->_indexed and abs(error) <= ENCODER_INDEX_TOLERANCE) {
+         return;
+      }
+      
+      ++self->_seq;
+      ENCODER_BARRIER();
+      int16_t raw = self->_raw - error;
+      if (raw < 0) {
+         raw += rev_tics;
+         self->_lap--;
+      }
+      else if (raw >= rev_tics) {
+         raw -= rev_tics;
+         self->_lap++;
+      }
+      self->_raw = raw;
+      self->_indexed = true;
+      ENCODER_BARRIER();
+      ++self->_seq;
+   }
+
+   static void _interrupt_x2(void* context)
+   {
+      static_cast<rotary_encoder*>(context)->_x2();
+   }
+
+   static void _interrupt_x4(void* context)
+   {
+      static_cast<rotary_encoder*>(context)->_x4();
+   }
+
+   inline void _x2()
+   {
+      uint8_t s = _read();
+      if (((s ^ _state) & 2) == 0) {
+         ++_invalid;
+         return;
+      }
+      uint32_t now = edges or _min_interval ? micros() : 0;
+      _state = s;
+      _edge(0, s == 0 or s == 3 ? -1 : 1, now);
+   }
 
-template<pin_t encoder_a, pin_t encoder_b, uint16_t rev_tics>
-volatile ang_t rotary_encoder<encoder_a, encoder_b, rev_tics>::_raw;
+   inline void _x4()
+   {
+      uint8_t s = _read();
+      int8_t d = int8_t(pgm_read_byte(ENCODER_TRANSITIONS + (_state << 2 | s)));
+      if (d == ENCODER_INVALID) {
+         _state = s;
+         ++_invalid;
+         return;
+      }
+      if (d == 0) {
+         return;
+      }
+      uint32_t now = edges or _min_interval ? micros() : 0;
+      uint8_t ch = (s ^ _state) & 1;
+      _state = s;
+      _edge(ch, d, now);
+   }
 
-template<pin_t encoder_a, pin_t encoder_b, uint16_t rev_tics>
-volatile int32_t rotary_encoder<encoder_a, encoder_b, rev_tics>::_lap;
+   pin_t _encoder_a;
+   pin_t _encoder_b;
+   pin_t _encoder_z;
+   
+   volatile ang_t   _raw;
+   volatile int32_t _lap;
+   volatile uint8_t _state;
+   volatile uint8_t _seq;
+   volatile uint32_t _invalid;
+   volatile uint32_t _glitches;
+   uint16_t _min_interval;
+
+   // Time and step of the last edge per channel (step 0 if it ended a glitch), and channel of the last step.
+   static constexpr uint8_t NO_CHANNEL = 2;
+   uint32_t _channel_edge[2];
+   int8_t _channel_step[2];
+   uint8_t _last_channel;
+
+   volatile uint8_t* _a_reg;
+   volatile uint8_t* _b_reg;
+   uint8_t _a_mask;
+   uint8_t _b_mask;
+
+   // Total count (without wrap) and timestamped edges.
+   volatile int32_t _count;
+   edge _edges[edges ? edges : 1];
+   volatile uint8_t _edge_index;
+   volatile uint8_t _edge_fill;
+
+   ang_t _index_raw;
+   volatile ang_t _index_error;
+   volatile bool _indexed;
+};
@@ -8,21 +8,147 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "containers.hpp"
 #include "event_queue.hpp"
+#include "format.hpp"
+#include "util.hpp"
 
 
+// Size of the sw send buffer, a power of two.
 #ifndef SERIAL_BUF_SIZE
 #define SERIAL_BUF_SIZE 1024
 #endif
 
-#define TMP_BUF_SIZE 32
+// Deferred mode, p() only stores the raw arguments (a tag and the value, strings by pointer) in the buffer and the
+// text conversion is done when draining the buffer in the event queue. This makes printing cheap in time critical
+// code, but const strings have to outlive the print (like string literals). Non-const strings (like a line from
+// read_line) are copied.
+#ifndef SERIAL_DEFERRED
+#define SERIAL_DEFERRED 0
+#endif
+
+// Max number of string literals waiting to be printed (not deferred mode). Literals are not copied into the buffer,
+// just a descriptor with pointer and length, the bytes are streamed directly from rodata or flash when draining. When
+// out of descriptors literals are copied. A power of two.
+#ifndef SERIAL_DESC_SIZE
+#define SERIAL_DESC_SIZE 16
+#endif
+
+// Max length of input lines, including ending zero.
+#ifndef SERIAL_RX_LINE_SIZE
+#define SERIAL_RX_LINE_SIZE 64
+#endif
+
+// Min time between reports of dropped messages.
+#ifndef SERIAL_DROP_REPORT_INTERVAL
+#define SERIAL_DROP_REPORT_INTERVAL SECOND
+#endif
+
+#define TMP_BUF_SIZE FORMAT_BUF_SIZE
+
+// Message levels. Lower levels may only fill part of the buffers, so there is always room left for more important
+// messages.
+enum class log_level : uint8_t
+{
+   DEBUG,
+   INFO,
+   WARN,
+   ERROR,
+};
+
+// Format argument with type erased, so printing with a format string is one non template call.
+struct format_arg
+{
+   enum type_t : uint8_t { NONE, STR, BUF, FLASH, LONG, ULONG, LLONG, ULLONG, FLOAT, CHAR, BOOL };
+
+   format_arg()                     : type(NONE) {}
+   format_arg(const char* v)        : type(STR), s(v) {}
+   format_arg(char* v)              : type(BUF), s(v) {}
+   format_arg(const __FlashStringHelper* v) : type(FLASH), s(reinterpret_cast<const char*>(v)) {}
+   format_arg(int v)                : type(LONG), l(v) {}
+   format_arg(unsigned int v)       : type(ULONG), ul(v) {}
+   format_arg(long v)               : type(LONG), l(v) {}
+   format_arg(unsigned long v)      : type(ULONG), ul(v) {}
+   format_arg(long long v)          : type(LLONG), ll(v) {}
+   format_arg(unsigned long long v) : type(ULLONG), ull(v) {}
+   format_arg(float v)              : type(FLOAT), f(v) {}
+   format_arg(double v)             : type(FLOAT), f(v) {}
+   format_arg(char v)               : type(CHAR), c(v) {}
+   format_arg(bool v)               : type(BOOL), b(v) {}
+
+   type_t type;
+   union {
+      const char* s;
+      long l;
+      unsigned long ul;
+      long long ll;
+      unsigned long long ull;
+      float f;
+      char c;
+      bool b;
+   };
+};
+
+template<typename... T> char (&format_arg_counter(T&&...))[sizeof...(T) + 1];
+
+// Number of macro arguments (can be empty).
+#define FORMAT_ARG_COUNT(...) (sizeof(format_arg_counter(__VA_ARGS__)) - 1)
+
+// Print with format string where {} are replaced by the arguments in order, like SERIAL_F(serial, "pos {}\n", pos).
+// The number of arguments is checked and the format string is parsed at compile time, the text between placeholders
+// is printed without copying (or scanning) it. Argument types are checked by format_arg.
+#define SERIAL_LOG_F(serial, level, fmt, ...)                                                                   \
+   do {                                                                                                         \
+      static_assert(format_placeholders(fmt) == FORMAT_ARG_COUNT(__VA_ARGS__),                                  \
+                    "number of {} in format string does not match number of arguments");                         \
+      static constexpr auto _segments = format_parse(fmt, format_make_indices<format_placeholders(fmt) + 1>::type()); \
+      (serial).logf(level, fmt, _segments.segment, ##__VA_ARGS__);                                               \
+   } while (0)
+
+#define SERIAL_F(serial, fmt, ...) SERIAL_LOG_F(serial, log_level::INFO, fmt, ##__VA_ARGS__)
+
+// Rate limit for a log call site, at most per_second messages each second. Suppressed messages are counted here, not
+// as drops, since they are expected.
+struct log_site
+{
+   log_site(uint16_t per_second) : _per_second(per_second), _count(0), _suppressed(0), _start(0) {}
+
+   bool allow()
+   {
+      timestamp_t now = now_us();
+      if (now - _start >= SECOND) {
+         _start = now;
+         _count = 0;
+      }
+      if (_count >= _per_second) {
+         ++_suppressed;
+         return false;
+      }
+      ++_count;
+      return true;
+   }
+
+   // Number of messages suppressed by the rate limit.
+   uint32_t suppressed() const
+   {
+      return _suppressed;
+   }
+   
+private:
+   uint16_t _per_second;
+   uint16_t _count;
+   uint32_t _suppressed;
+   timestamp_t _start;
+};
 
 struct noblock_serial : event_queue::callback_obj
 {
 
    noblock_serial(event_queue* eq=nullptr, uint32_t baud_rate=9600) :
-      _event_queue(eq), _baud_rate(baud_rate), _head(_buf), _tail(_buf), _size(0), _wait(1e6 * 10 / baud_rate)
+      _event_queue(eq), _baud_rate(baud_rate), _pushed(0), _drained(0), _out(nullptr), _out_len(0), _out_flash(false), _raw_left(0), _precision(3),
+      _rx_len(0), _rx_done(false), _hw_size(1), _drops_reported(0), _wait(1e6 * 10 / baud_rate)
    {
+      memset(_dropped, 0, sizeof(_dropped));
       begin();
    }
 
@@ -34,65 +160,112 @@ struct noblock_serial : event_queue::callback_obj
    // Returns true if bot hw send buffer and sw send buffers are empty.
    bool tx_empty()
    {
-      return Serial.availableForWrite() == 0 and _head == _tail;
+      return Serial.availableForWrite() == 0 and _sw_empty();
    }
 
    // Clear printing buffers, can be nice to use for high priority messages.
    void clear()
    {
-      _head = _buf;
-      _tail = _buf;
+      _buf.clear();
+      _desc.clear();
+      _out_len = 0;
+      _raw_left = 0;
+      _drained = _pushed;
    }
    
-   // Print message on serial, not blocking, stops adding parameters when buffer is full.
+   // Set number of decimals when printing floats (max FORMAT_MAX_PRECISION).
+   noblock_serial& precision(uint8_t decimals)
+   {
+      _precision = decimals;
+      return *this;
+   }
+   
+   // Print message on serial (as info), not blocking, stops adding parameters when buffer is full. String literals
+   // and F() strings are not copied, so const char arrays filled by their string need to live until printed.
    template<typename T, typename... Rest>
-   noblock_serial& p(T m, Rest... rest)
+   noblock_serial& p(T&& m, Rest&&... rest)
    {
-      char buf[TMP_BUF_SIZE];
+      return log(log_level::INFO, m, rest...);
+   }
 
-      const char* result = _p(buf, m);
-      auto len = strlen(result); // strnlen not available?
+   // Print message with level, the message is dropped if the buffers are too full for the level.
+   template<typename... Args>
+   noblock_serial& log(log_level level, Args&&... args)
+   {
+      if (not _admit(level) or not _p_all(args...)) {
+         ++_dropped[uint8_t(level)];
+      }
+      return *this;
+   }
 
-      if (_size == 0 and len <= Serial.availableForWrite()) {
-         // Print directly into hw buffer.
-         Serial.print(result);
+   // Print with parsed format string, use SERIAL_F or SERIAL_LOG_F.
+   template<typename... Args>
+   noblock_serial& logf(log_level level, const char* fmt, const format_segment* segments, Args&&... args)
+   {
+      const format_arg values[] = { format_arg(args)..., format_arg() };
+      if (not _admit(level) or not _format(fmt, segments, values, sizeof...(Args))) {
+         ++_dropped[uint8_t(level)];
       }
-      else if (len < SERIAL_BUF_SIZE - _size) {
-         // Add result to sw buffer and make sure we are in the event queue.
-         if (_tail - _buf + len < SERIAL_BUF_SIZE) {
-            // Simple case, copy into buf.
-            strncpy(_tail, result, len);
-            _tail += len;
-            _size += len;
-         }
-         else {
-            // Copy in two steps (spanning the buffer end).
-            uint32_t len1 = SERIAL_BUF_SIZE - (_tail - _buf);
-            strncpy(_tail, result, len1);
-            strncpy(_buf, result + len1, len - len1);
-            _tail = _buf + len - len1;
-            _size += len;
-         }
-
-         if (not _event_queue->present(this)) {
-            if (not _event_queue->running()) {
-               // If possible, print a warning if the event queue is not running.
-               if (1 <= Serial.availableForWrite()) {
-                  Serial.print("¤");
-               }
-            }
-            _event_queue->enqueue_now(this);
-         }
+      return *this;
+   }
+   
+   // Print message with level, rate limited by site (see log_site::suppressed).
+   template<typename... Args>
+   noblock_serial& log(log_site& site, log_level level, Args&&... args)
+   {
+      if (not site.allow()) {
+         return *this;
       }
-      else {
-         // All buffers are full, not more printing.
-         return p();
+      return log(level, args...);
+   }
+
+   // Write raw bytes on serial, not blocking. All or nothing, returns false if there was no room.
+   bool write(const uint8_t* data, uint32_t len)
+   {
+      if (not SERIAL_DEFERRED) {
+         return _push(reinterpret_cast<const char*>(data), len);
       }
 
-      return p(rest...);
+      uint16_t len16 = len;
+      if (len16 != len or len + 1 + sizeof(len16) >= uint32_t(SERIAL_BUF_SIZE - _buf.size())) {
+         return false;
+      }
+      tag_t tag = TAG_RAW;
+      _put(&tag, 1);
+      _put(&len16, sizeof(len16));
+      _put(data, len);
+      _schedule();
+      return true;
    }
-
+   
    noblock_serial& p() { return *this; }
+
+   // Read available input without blocking, returns a complete line (zero terminated, without line ending) or nullptr
+   // if there is no complete line yet. The line is valid until the next call. Too long lines are truncated.
+   char* read_line()
+   {
+      if (_rx_done) {
+         _rx_len = 0;
+         _rx_done = false;
+      }
+      
+      while (Serial.available() > 0) {
+         char c = Serial.read();
+         if (c == '\n' or c == '\r') {
+            if (_rx_len == 0) {
+               // Empty line or second half of \r\n.
+               continue;
+            }
+            _rx_line[_rx_len] = '\0';
+            _rx_done = true;
+            return _rx_line;
+         }
+         if (_rx_len < SERIAL_RX_LINE_SIZE - 1) {
+            _rx_line[_rx_len++] = c;
+         }
+      }
+      return nullptr;
+   }
    
    // Print into hw buffer directly (like Serial.print), may block if hw buffer is not big enough.
    template<typename T, typename... Rest>
@@ -102,27 +275,65 @@ struct noblock_serial : event_queue::callback_obj
       return pr(rest...);
    }
 
+   // Drain sw buffer into hw buffer, as much as there is room for, then check again when the hw buffer is almost empty.
    virtual void operator()(event_queue& event_queue)
    {
-      if (_size == 0) {
-         return;
-      }
-
-      int32_t copy = min(Serial.availableForWrite(), int32_t(_size));
+      // Report drops also under steady load, when the buffer never runs empty.
+      bool drops_pending = _report_drops();
       
-      if (copy > 0) {
-         if (SERIAL_BUF_SIZE < _head - _buf + copy) {
-            copy = SERIAL_BUF_SIZE - (_head - _buf);
+      int32_t room = _room();
+      while (room > 0) {
+         if (_out_len > 0) {
+            // Text of current literal or deferred record.
+            uint32_t copy = _write(_out, min(uint32_t(room), _out_len), _out_flash);
+            _out += copy;
+            _out_len -= copy;
+            room -= copy;
+         }
+         else if (_raw_left > 0) {
+            // Bytes in the sw buffer as is.
+            uint32_t copy = min(min(uint32_t(room), _raw_left), uint32_t(_buf.front_span()));
+            if (copy == 0) {
+               break;
+            }
+            Serial.write(&_buf.front(), copy);
+            _skip(copy);
+            _raw_left -= copy;
+            room -= copy;
          }
-         Serial.write(_head, copy);
-         _head += copy;
-         _size -= copy;
-         if (SERIAL_BUF_SIZE <= _head - _buf) {
-            _head = _buf;
+         else if (not _desc.empty() and _desc.front().at == _drained) {
+            // Next is a literal.
+            const desc_t& desc = _desc.front();
+            _out = desc.str;
+            _out_len = desc.len;
+            _out_flash = desc.flash;
+            _desc.pop_front();
+         }
+         else if (not _buf.empty()) {
+            if (SERIAL_DEFERRED) {
+               _next_record();
+            }
+            else {
+               // Bytes up to the next literal.
+               _raw_left = not _desc.empty() ? _desc.front().at - _drained : _buf.size();
+            }
+         }
+         else {
+            if (drops_pending) {
+               // Come back when it is time to report.
+               timestamp_t since = now_us() - _drops_reported;
+               _event_queue->enqueue_rel(this, since < SERIAL_DROP_REPORT_INTERVAL ?
+                                         SERIAL_DROP_REPORT_INTERVAL - since : 0);
+            }
+            return;
          }
       }
 
-      _event_queue->enqueue_rel(this, _wait);
+      // The hw buffer size is not available, but it is at least the largest room seen. Wake up when it is down to a
+      // quarter full, in time to fill it again before it runs dry.
+      int32_t queued = _hw_size - room;
+      uint32_t bytes = queued > _hw_size / 4 ? queued - _hw_size / 4 : 1;
+      _event_queue->enqueue_rel(this, bytes * _wait);
    }
    
    noblock_serial& pr() { return *this; }
@@ -134,88 +345,375 @@ struct noblock_serial : event_queue::callback_obj
    
 private:
 
-   const char* _p(char* buf, bool m)
+   // Add len bytes of data to the hw buffer if possible, otherwise to the sw buffer. All or nothing, returns false if
+   // there was no room.
+   bool _push(const char* data, uint32_t len)
    {
-      if (m) {
-         return "true";
+      if (_sw_empty() and len <= uint32_t(_room())) {
+         // Print directly into hw buffer.
+         Serial.write(reinterpret_cast<const uint8_t*>(data), len);
+         return true;
       }
-      return "false";
+
+      if (len >= uint32_t(SERIAL_BUF_SIZE - _buf.size())) {
+         return false;
+      }
+      
+      // Add data to sw buffer and make sure we are in the event queue.
+      _put(data, len);
+      _schedule();
+      return true;
    }
-   
-   const char* _p(char* buf, char m)
+
+   // Add string literal (in flash if flash is true) as a descriptor, returns false if there was no room.
+   bool _literal(const char* str, uint32_t len, bool flash)
    {
-      buf[0] = m;
-      buf[1] = '\0';
-      return buf;
+      if (_sw_empty() and len <= uint32_t(_room())) {
+         // Print directly into hw buffer.
+         _write(str, len, flash);
+         return true;
+      }
+
+      if (_desc.full()) {
+         // No descriptor left, copy it instead.
+         if (not flash) {
+            return _push(str, len);
+         }
+         if (len >= uint32_t(SERIAL_BUF_SIZE - _buf.size())) {
+            return false;
+         }
+         for (uint32_t i = 0; i < len; ++i) {
+            char c = pgm_read_byte(str + i);
+            _put(&c, 1);
+         }
+         _schedule();
+         return true;
+      }
+
+      _desc.push_back(desc_t{ str, uint16_t(len), flash, _pushed });
+      _schedule();
+      return true;
    }
-   
-   const char* _p(char* buf, long m)
+
+   // Write len bytes of str to hw buffer, returns len.
+   uint32_t _write(const char* str, uint32_t len, bool flash)
    {
-      // Print the string backwards.
-      char* r = buf + TMP_BUF_SIZE;
-      *--r = '\0';
+      if (not flash) {
+         Serial.write(reinterpret_cast<const uint8_t*>(str), len);
+         return len;
+      }
 
-      bool neg = false;
-      if (m < 0) {
-         neg = true;
-         m = -m;
+      // Copy from flash in chunks.
+      uint8_t chunk[16];
+      for (uint32_t done = 0; done < len;) {
+         uint8_t n = min(len - done, uint32_t(sizeof(chunk)));
+         for (uint8_t i = 0; i < n; ++i) {
+            chunk[i] = pgm_read_byte(str + done + i);
+         }
+         Serial.write(chunk, n);
+         done += n;
       }
+      return len;
+   }
 
-      if (m == 0) {
-         *--r = '0';
+   bool _p_all() { return true; }
+   
+   // Print all parameters, returns false if the buffers got full.
+   template<typename T, typename... Rest>
+   bool _p_all(T&& m, Rest&&... rest)
+   {
+      if (not _one(m)) {
+         return false;
       }
-      else {
-         while (m > 0 and r > buf) {
-            int div = m / 10;
-            int rest = m - div * 10;
-            *--r = '0' + rest;
-            m = div;
+      return _p_all(rest...);
+   }
+
+   template<typename T>
+   bool _one(T& m)
+   {
+      return SERIAL_DEFERRED ? _defer(m) : _print(m);
+   }
+
+   // Print segments of fmt with count values in between, returns false if the buffers got full.
+   bool _format(const char* fmt, const format_segment* segments, const format_arg* values, uint8_t count)
+   {
+      for (uint8_t i = 0; ; ++i) {
+         if (segments[i].len > 0 and not _segment(fmt + segments[i].start, segments[i].len)) {
+            return false;
+         }
+         if (i == count) {
+            return true;
+         }
+         const format_arg& v = values[i];
+         const __FlashStringHelper* flash = reinterpret_cast<const __FlashStringHelper*>(v.s);
+         bool ok = false;
+         switch (v.type) {
+            case format_arg::STR:    ok = _one(v.s); break;
+            case format_arg::BUF:    { char* buf = const_cast<char*>(v.s); ok = _one(buf); break; }
+            case format_arg::FLASH:  ok = _one(flash); break;
+            case format_arg::LONG:   ok = _one(v.l); break;
+            case format_arg::ULONG:  ok = _one(v.ul); break;
+            case format_arg::LLONG:  ok = _one(v.ll); break;
+            case format_arg::ULLONG: ok = _one(v.ull); break;
+            case format_arg::FLOAT:  ok = _one(v.f); break;
+            case format_arg::CHAR:   ok = _one(v.c); break;
+            case format_arg::BOOL:   ok = _one(v.b); break;
+            case format_arg::NONE:   break;
+         }
+         if (not ok) {
+            return false;
          }
       }
+   }
 
-      if (neg) {
-         *--r = '-';
+   // Print len chars of str (a literal) without copying.
+   bool _segment(const char* str, uint8_t len)
+   {
+      if (not SERIAL_DEFERRED) {
+         return _literal(str, len, false);
       }
-      
-      return r;
+      segment_record r = { str, len };
+      return _record(TAG_SEGMENT, &r, sizeof(r));
    }
 
-   const char* _p(char* buf, float m)
+   // Returns true if a message of level may be added, each level may fill a share (in eighths) of the buffers.
+   bool _admit(log_level level)
    {
-      bool neg = false;
-      if (m < 0) {
-         neg = true;
-         m = -m;
+      static const uint8_t share[] = { 4, 6, 7, 8 };
+      uint8_t limit = share[uint8_t(level)];
+      return _buf.size() * 8 < uint32_t(SERIAL_BUF_SIZE) * limit;
+   }
+
+   // Print number of dropped messages per level if any since last report, at most every SERIAL_DROP_REPORT_INTERVAL.
+   // The report is admitted as a warning, so it fits even when debug and info messages are dropped. Returns true if
+   // there are drops to report later.
+   bool _report_drops()
+   {
+      if (not (_dropped[0] or _dropped[1] or _dropped[2] or _dropped[3])) {
+         return false;
       }
       
-      // As a quick hack for now print as a fixed point number with 3 decimals.
-      auto r = const_cast<char*>(_p(buf, long(m * 1000)));
-      
-      // Insert decimal point and zeroes if needed.
-      char* p = r;
-      while (p >= buf + TMP_BUF_SIZE - 4) {
-         *--p = '0';
+      timestamp_t now = now_us();
+      if (now - _drops_reported < SERIAL_DROP_REPORT_INTERVAL or not _admit(log_level::WARN)) {
+         return true;
       }
       
-      memmove(p - 1, p, (buf + TMP_BUF_SIZE - 4) - p);
-      buf[TMP_BUF_SIZE - 5] = '.';
-      --p;
-      
-      if (neg) {
-         *--p = '-';
+      if (_p_all("dropped messages, debug ", _dropped[0], ", info ", _dropped[1], ", warn ", _dropped[2],
+                 ", error ", _dropped[3], "\n")) {
+         memset(_dropped, 0, sizeof(_dropped));
+         _drops_reported = now;
+         return false;
       }
-      
-      return p;
+      return true;
+   }
+   
+   // Room in hw buffer, also keeps track of the largest room seen.
+   int32_t _room()
+   {
+      int32_t room = Serial.availableForWrite();
+      if (_hw_size < room) {
+         _hw_size = room;
+      }
+      return room;
+   }
+   
+   // Returns true if nothing is waiting in sw buffers.
+   bool _sw_empty()
+   {
+      return _buf.empty() and _desc.empty() and _out_len == 0;
+   }
+   
+   // Copy len bytes of data to the sw buffer tail, there needs to be room.
+   void _put(const void* data, uint32_t len)
+   {
+      _buf.write(reinterpret_cast<const char*>(data), len);
+      _pushed += len;
+   }
+
+   // Copy len bytes from the sw buffer head to data and remove them from the buffer.
+   void _get(void* data, uint32_t len)
+   {
+      _buf.read(reinterpret_cast<char*>(data), len);
+      _drained += len;
+   }
+
+   // Remove len bytes from sw buffer head.
+   void _skip(uint32_t len)
+   {
+      _buf.skip(len);
+      _drained += len;
+   }
+
+   // Make sure we are in the event queue to drain the sw buffer.
+   void _schedule()
+   {
+      if (not _event_queue->present(this)) {
+         if (not _event_queue->running()) {
+            // If possible, print a warning if the event queue is not running.
+            if (1 <= Serial.availableForWrite()) {
+               Serial.print("¤");
+            }
+         }
+         _event_queue->enqueue_now(this);
+      }
+   }
+
+   // Format and push m, returns false if there was no room.
+   template<typename T>
+   bool _print(const T& m)
+   {
+      char buf[TMP_BUF_SIZE];
+      const char* result = _p(buf, m);
+      return _push(result, strlen(result));
    }
 
-   const char* _p(char* buf, int m)
+   // A literal fills its array, print without copying. A const array with a shorter string is probably a buffer, copy.
+   template<size_t N>
+   bool _print(const char (&m)[N])
    {
-      return _p(buf, long(m));
+      uint32_t len = strnlen(m, N - 1);
+      return len == N - 1 ? _literal(m, len, false) : _push(m, len);
    }
 
-   const char* _p(char* buf, unsigned long m)
+   // Not a literal, copy.
+   template<size_t N>
+   bool _print(char (&m)[N])
    {
-      return _p(buf, long(m));
+      return _push(m, strlen(m));
+   }
+
+   bool _print(const __FlashStringHelper* m)
+   {
+      auto str = reinterpret_cast<const char*>(m);
+      return _literal(str, strlen_P(str), true);
+   }
+
+   // Record tags in deferred mode, each record is a tag followed by the raw value.
+   enum tag_t : uint8_t {
+      TAG_STR, TAG_FLASH, TAG_SEGMENT, TAG_LONG, TAG_ULONG, TAG_LLONG, TAG_ULLONG, TAG_FLOAT, TAG_CHAR, TAG_BOOL,
+      TAG_RAW,
+   };
+
+   // Part of a literal.
+   struct segment_record { const char* str; uint8_t len; };
+   
+   // Float record, precision is taken at print time.
+   struct float_record { float m; uint8_t precision; };
+   
+   bool _defer(const char* m)        { return _record(TAG_STR, &m, sizeof(m)); }
+   bool _defer(char* m)              { return write(reinterpret_cast<const uint8_t*>(m), strlen(m)); }
+   bool _defer(const __FlashStringHelper* m) { return _record(TAG_FLASH, &m, sizeof(m)); }
+   bool _defer(long m)               { return _record(TAG_LONG, &m, sizeof(m)); }
+   bool _defer(int m)                { return _defer(long(m)); }
+   bool _defer(unsigned long m)      { return _record(TAG_ULONG, &m, sizeof(m)); }
+   bool _defer(unsigned int m)       { return _defer((unsigned long)m); }
+   bool _defer(long long m)          { return _record(TAG_LLONG, &m, sizeof(m)); }
+   bool _defer(unsigned long long m) { return _record(TAG_ULLONG, &m, sizeof(m)); }
+   bool _defer(double m)             { return _defer(float(m)); }
+   bool _defer(float m)
+   {
+      float_record r = { m, _precision };
+      return _record(TAG_FLOAT, &r, sizeof(r));
+   }
+   bool _defer(char m)          { return _record(TAG_CHAR, &m, sizeof(m)); }
+   bool _defer(bool m)          { return _record(TAG_BOOL, &m, sizeof(m)); }
+
+   // Add record to sw buffer, returns false if there was no room.
+   bool _record(tag_t tag, const void* data, uint32_t len)
+   {
+      if (len + 1 >= uint32_t(SERIAL_BUF_SIZE - _buf.size())) {
+         return false;
+      }
+      _put(&tag, 1);
+      _put(data, len);
+      _schedule();
+      return true;
+   }
+
+   // Take the next record from the sw buffer and format it for output.
+   void _next_record()
+   {
+      tag_t tag;
+      _get(&tag, 1);
+      _out_flash = false;
+      switch (tag) {
+         case TAG_STR:    { const char* m;        _get(&m, sizeof(m)); _out = m; break; }
+         case TAG_FLASH:  {
+            _get(&_out, sizeof(_out));
+            _out_len = strlen_P(_out);
+            _out_flash = true;
+            return;
+         }
+         case TAG_LONG:   { long m;               _get(&m, sizeof(m)); _out = _p(_fmt_buf, m); break; }
+         case TAG_ULONG:  { unsigned long m;      _get(&m, sizeof(m)); _out = _p(_fmt_buf, m); break; }
+         case TAG_LLONG:  { long long m;          _get(&m, sizeof(m)); _out = _p(_fmt_buf, m); break; }
+         case TAG_ULLONG: { unsigned long long m; _get(&m, sizeof(m)); _out = _p(_fmt_buf, m); break; }
+         case TAG_CHAR:   { char m;               _get(&m, sizeof(m)); _out = _p(_fmt_buf, m); break; }
+         case TAG_BOOL:   { bool m;               _get(&m, sizeof(m)); _out = _p(_fmt_buf, m); break; }
+         case TAG_FLOAT:  {
+            float_record r;
+            _get(&r, sizeof(r));
+            _out = format_float(_end(_fmt_buf), r.m, r.precision);
+            break;
+         }
+         case TAG_SEGMENT: {
+            segment_record r;
+            _get(&r, sizeof(r));
+            _out = r.str;
+            _out_len = r.len;
+            return;
+         }
+         case TAG_RAW:    { uint16_t len; _get(&len, sizeof(len)); _raw_left = len; return; }
+      }
+      _out_len = strlen(_out);
+   }
+   
+   const char* _p(char* buf, bool m)
+   {
+      if (m) {
+         return "true";
+      }
+      return "false";
+   }
+   
+   const char* _p(char* buf, char m)
+   {
+      buf[0] = m;
+      buf[1] = '\0';
+      return buf;
+   }
+   
+   const char* _p(char* buf, int m)                { return _integer(buf, m); }
+   const char* _p(char* buf, unsigned int m)       { return _integer(buf, m); }
+   const char* _p(char* buf, long m)               { return _integer(buf, m); }
+   const char* _p(char* buf, unsigned long m)      { return _integer(buf, m); }
+   const char* _p(char* buf, long long m)          { return _integer(buf, m); }
+   const char* _p(char* buf, unsigned long long m) { return _integer(buf, m); }
+
+   const char* _p(char* buf, float m)
+   {
+      return format_float(_end(buf), m, _precision);
+   }
+
+   const char* _p(char* buf, double m)
+   {
+      return _p(buf, float(m));
+   }
+
+   template<typename T>
+   const char* _integer(char* buf, T m)
+   {
+      if (sizeof(T) <= sizeof(int32_t)) {
+         return T(-1) < T(0) ? format_i32(_end(buf), m) : format_u32(_end(buf), m);
+      }
+      return T(-1) < T(0) ? format_i64(_end(buf), m) : format_u64(_end(buf), m);
+   }
+
+   // Terminate buf and return end for formatting backwards.
+   char* _end(char* buf)
+   {
+      buf[TMP_BUF_SIZE - 1] = '\0';
+      return buf + TMP_BUF_SIZE - 1;
    }
    
    const char* _p(char* buf, const char* m)
@@ -224,15 +722,49 @@ private:
    }
 
    event_queue* _event_queue;
-   char _buf[SERIAL_BUF_SIZE];
+   // As long as the buffer is not empty we enqueue checking of the buffer.
+   ring_buffer<char, SERIAL_BUF_SIZE> _buf;
 
    uint32_t _baud_rate;
+
+   // Total number of bytes pushed to and drained from the buffer, positions literals in the byte stream.
+   uint32_t _pushed;
+   uint32_t _drained;
+
+   // Ring of literals waiting to be printed.
+   struct desc_t
+   {
+      const char* str;
+      uint16_t len;
+      bool flash;
+      uint32_t at;
+   };
+   ring_buffer<desc_t, SERIAL_DESC_SIZE> _desc;
    
-   // Head and tail of the buffer. As long as _size > 0 we enqueue checking of the buffer.
-   char* _head;
-   char* _tail;
-   uint32_t _size;
+   // Text being drained, a literal, a string or formatted into _fmt_buf (deferred mode).
+   const char* _out;
+   uint32_t _out_len;
+   bool _out_flash;
+   char _fmt_buf[TMP_BUF_SIZE];
+
+   // Bytes at head to drain as is.
+   uint32_t _raw_left;
+
+   // Float decimals.
+   uint8_t _precision;
 
-   // Event queue wait time.
+   // Input line being read, done when a line ending is received.
+   char _rx_line[SERIAL_RX_LINE_SIZE];
+   uint8_t _rx_len;
+   bool _rx_done;
+
+   // Largest hw buffer room seen.
+   int32_t _hw_size;
+
+   // Dropped (or truncated) messages per level since last report.
+   uint16_t _dropped[4];
+   timestamp_t _drops_reported;
+   
+   // Time to send one byte.
    uint32_t _wait;
 };
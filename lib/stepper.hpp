@@ -5,13 +5,15 @@
 //
 // Will run the motor to a position (designated by a absolute position in full steps).
 //
-// WARNING: Timing uses uint32_t for counting us, undefined behaviour if more than 2^32 us (~71 mins) since micro
-// controller reset.
+// WARNING: Timing uses timestamp_t for counting us, with 32 bit timestamps (the default) it is undefined behaviour if
+// more than 2^32 us (~71 mins) since micro controller reset, build with TIMESTAMP_BITS=64 for long runs.
 //
 // WARNING: Will do busy waits for small (~1 us) waits, this is probably a bad idea for fast CPUs (>~100 MHz). Also
 // since we don't have nano timestamp we will have to wait 1 us extra all the time (473 to 474 can be 1ns if unlucky).
 //
 
+#include "profile.hpp"
+
 using namespace std;
 
 //
@@ -312,7 +314,7 @@ stepper::calibrate_position(int32_t pos)
 timestamp_t
 stepper::on()
 {
-   uint32_t now = now_us();
+   timestamp_t now = now_us();
    digitalWrite(_enable_pin, STEPPER_ENABLE);
    _state = ACCEL;
    _accel_steps = 0;
@@ -325,7 +327,7 @@ stepper::on()
 timestamp_t
 stepper::off()
 {
-   uint32_t now = now_us();
+   timestamp_t now = now_us();
    digitalWrite(_enable_pin, not STEPPER_ENABLE);
    _state = OFF;
    return now + ENABLE_US + 1;
@@ -388,6 +390,8 @@ stepper::target_speed(float speed)
 timestamp_t
 stepper::step()
 {
+   PROFILE_SCOPE("step");
+   
    delay_t d = max(_delay, _target_delay);
    auto micro = _micro;
 
@@ -403,7 +407,7 @@ stepper::step()
    }
 
    if (micro != _micro) {
-      uint32_t start = now_us();
+      timestamp_t start = now_us();
       micro_set();
       // Busy wait for mode change here, not good but ok.
       
@@ -498,7 +502,7 @@ stepper::step()
    
    // Make sure time have passed, then downstep.
 
-   uint32_t now;   
+   timestamp_t now;
    while (true) {
       now = now_us();
       if (step_timestamp + STEPPING_PULSE_US + 1 < now) {
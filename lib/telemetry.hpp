@@ -0,0 +1,164 @@
+#pragma once
+
+//
+// Binary telemetry over noblock_serial, a lot more compact and cheaper to produce than text.
+//
+// Each frame is COBS encoded and put between zero bytes, so text and frames can be mixed on the same line (the decoder
+// drops everything that is not a valid frame). Decoded frame:
+//
+//   type (1 byte) | fields (packed, native little endian) | crc8 of type and fields (1 byte)
+//
+// Type 0 is schema frames describing other types, so the stream can be decoded without knowing the firmware:
+//
+//   0 | described type | name | 0 | format (python struct chars, one per field) | 0 | comma separated column names
+//
+// Types 0xf0 and above are reserved (see lib/trace.hpp). Use tools/telemetry-csv.py to decode a stream into csv.
+//
+// A telemetry_message ties the type, schema and field types together, so what is sent can't drift from what is
+// described:
+//
+//   const telemetry_message<1, uint32_t, ang_t> TICK("tick", "tick,ang");
+//   tm.describe(TICK);
+//   tm.send(TICK, tick_count, ang); // Compile error unless exactly uint32_t and ang_t.
+//
+
+#include "serial.hpp"
+#include "framing.hpp"
+
+// Max size of a decoded frame, including type and crc.
+#ifndef TELEMETRY_FRAME_SIZE
+#define TELEMETRY_FRAME_SIZE 64
+#endif
+
+// Python struct format char for field type T.
+template<typename T> constexpr char telemetry_format()
+{
+   return T(-1) < T(0)
+      ? (sizeof(T) == 1 ? 'b' : sizeof(T) == 2 ? 'h' : sizeof(T) == 4 ? 'i' : 'q')
+      : (sizeof(T) == 1 ? 'B' : sizeof(T) == 2 ? 'H' : sizeof(T) == 4 ? 'I' : 'Q');
+}
+template<> constexpr char telemetry_format<float>() { return 'f'; }
+template<> constexpr char telemetry_format<double>() { return sizeof(double) == 4 ? 'f' : 'd'; }
+template<> constexpr char telemetry_format<bool>() { return '?'; }
+
+// Message type with the field types, see describe and send.
+template<uint8_t type, typename... Fields>
+struct telemetry_message
+{
+   constexpr telemetry_message(const char* name, const char* columns) : name(name), columns(columns) {}
+
+   const char* name;
+   const char* columns;
+};
+
+template<typename... T> struct telemetry_types {};
+
+template<typename A, typename B> struct telemetry_same { static constexpr bool value = false; };
+template<typename A> struct telemetry_same<A, A> { static constexpr bool value = true; };
+
+// Packed size of fields.
+constexpr uint16_t telemetry_size() { return 0; }
+template<typename T, typename... Rest> constexpr uint16_t telemetry_size(T field, Rest... rest)
+{
+   return sizeof(T) + telemetry_size(rest...);
+}
+
+struct telemetry
+{
+   telemetry(noblock_serial& serial) : _serial(serial) {}
+
+   // Send schema for message type, the field types are the template arguments and should be the same types as used
+   // when sending, for example describe<int32_t, ang_t>(1, "tick", "pos,ang"). Send it now and then since the receiver
+   // can start listening at any time. Returns false if not sent (no room).
+   template<typename... Fields>
+   bool describe(uint8_t type, const char* name, const char* columns)
+   {
+      const char format[] = { telemetry_format<Fields>()..., '\0' };
+
+      uint8_t frame[TELEMETRY_FRAME_SIZE];
+      uint16_t len = 0;
+      frame[len++] = 0;
+      frame[len++] = type;
+      if (not _add(frame, len, name) or not _add(frame, len, format) or not _add(frame, len, columns, false)) {
+         return false;
+      }
+      return _send(frame, len);
+   }
+
+   // Send schema of message, see describe above.
+   template<uint8_t type, typename... Fields>
+   bool describe(const telemetry_message<type, Fields...>& message)
+   {
+      return describe<Fields...>(type, message.name, message.columns);
+   }
+
+   // Send message, the fields need to be of exactly the described types (cast if needed).
+   template<uint8_t type, typename... Fields, typename... Args>
+   bool send(const telemetry_message<type, Fields...>& message, Args... fields)
+   {
+      static_assert(telemetry_same<telemetry_types<Fields...>, telemetry_types<Args...>>::value,
+                    "sent fields does not match the described types");
+      return send(type, fields...);
+   }
+
+   // Send message of type (1 to 255) with fields packed as is. Returns false if not sent (no room).
+   template<typename... Fields>
+   bool send(uint8_t type, Fields... fields)
+   {
+      static_assert(telemetry_size(Fields()...) + 2 <= TELEMETRY_FRAME_SIZE, "fields does not fit in frame");
+
+      uint8_t frame[TELEMETRY_FRAME_SIZE];
+      frame[0] = type;
+      return _send(frame, 1 + _pack(frame + 1, fields...));
+   }
+
+   // Send message of type with len bytes of payload as is. Returns false if not sent (no room or too large).
+   bool send_raw(uint8_t type, const void* data, uint16_t len)
+   {
+      if (len + 2 > TELEMETRY_FRAME_SIZE) {
+         return false;
+      }
+      uint8_t frame[TELEMETRY_FRAME_SIZE];
+      frame[0] = type;
+      memcpy(frame + 1, data, len);
+      return _send(frame, len + 1);
+   }
+
+private:
+
+   // Add string (with ending zero if zero is true) to frame at len, returns false if it does not fit.
+   bool _add(uint8_t* frame, uint16_t& len, const char* str, bool zero=true)
+   {
+      uint16_t n = strlen(str) + zero;
+      if (len + n + 1 > TELEMETRY_FRAME_SIZE) {
+         return false;
+      }
+      memcpy(frame + len, str, n);
+      len += n;
+      return true;
+   }
+
+   inline uint16_t _pack(uint8_t* p) { return 0; }
+
+   template<typename T, typename... Rest>
+   inline uint16_t _pack(uint8_t* p, T field, Rest... rest)
+   {
+      memcpy(p, &field, sizeof(T));
+      return sizeof(T) + _pack(p + sizeof(T), rest...);
+   }
+
+   // Add crc, encode and send frame of len bytes (frame needs room for the crc).
+   bool _send(uint8_t* frame, uint16_t len)
+   {
+      frame[len] = crc8(frame, len);
+      ++len;
+
+      uint8_t out[cobs_max_size(TELEMETRY_FRAME_SIZE) + 2];
+      out[0] = 0;
+      uint16_t out_len = 1 + cobs_encode(frame, len, out + 1);
+      out[out_len++] = 0;
+      return _serial.write(out, out_len);
+   }
+
+   noblock_serial& _serial;
+};
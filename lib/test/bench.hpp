@@ -0,0 +1,41 @@
+#pragma once
+
+//
+// Minimal host benchmark harness. BENCH(name) { ... } defines a case where the body should do its work n times, it is
+// timed by run_bench.cpp with n growing until the run is long enough to be measured.
+//
+
+#include <stdint.h>
+#include <vector>
+
+struct bench_case
+{
+   const char* name;
+   void (*fun)(uint32_t n);
+};
+
+std::vector<bench_case>& bench_cases()
+{
+   static std::vector<bench_case> cases;
+   return cases;
+}
+
+struct bench_register
+{
+   bench_register(const char* name, void (*fun)(uint32_t n))
+   {
+      bench_cases().push_back({name, fun});
+   }
+};
+
+#define BENCH(name)                                      \
+   void name(uint32_t n);                                \
+   bench_register name##_register(#name, name);          \
+   void name(uint32_t n)
+
+// Make the compiler believe v is used so the work is not optimized away.
+template<typename T>
+inline void bench_keep(const T& v)
+{
+   asm volatile("" : : "g"(&v) : "memory");
+}
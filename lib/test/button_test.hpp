@@ -0,0 +1,130 @@
+#include <boost/test/unit_test.hpp>
+
+#include "mock.hpp"
+#include "lib/util.hpp"
+#include "lib/event_queue.hpp"
+#include "lib/button.hpp"
+
+using namespace std;
+
+uint32_t button_presses = 0;
+uint32_t button_releases = 0;
+
+void count_press(event_queue& eq, const timestamp_t& when) { ++button_presses; }
+
+void count_release(event_queue& eq, const timestamp_t& when) { ++button_releases; }
+
+BOOST_AUTO_TEST_CASE(test_event_button_debounces_and_posts_changes)
+{
+   mock_virtual_time(true, 1);
+   button_presses = 0;
+   button_releases = 0;
+   mock_input(60, 0);
+   event_queue eq;
+   event_button but(eq, 60);
+
+   but.on_press(count_press);
+   eq.run_for(BUTTON_DEBOUNCE * 2);
+   BOOST_CHECK_EQUAL(0, button_presses);
+
+   // Bouncing press, one callback after the pin is stable.
+   mock_input(60, 1);
+   delayMicroseconds(100);
+   mock_input(60, 0);
+   delayMicroseconds(100);
+   mock_input(60, 1);
+   auto r = eq.run_for(BUTTON_DEBOUNCE / 2);
+   BOOST_CHECK_EQUAL(0, button_presses);
+   r = eq.run_for(BUTTON_DEBOUNCE);
+   BOOST_CHECK_EQUAL(1, button_presses);
+   BOOST_CHECK(r.dispatched < 5);
+   BOOST_CHECK(but.value());
+   BOOST_CHECK(not but.pressed());
+
+   // Release without waiting callback, seen by pressed once.
+   mock_input(60, 0);
+   eq.run_for(BUTTON_DEBOUNCE * 2);
+   BOOST_CHECK(not but.value());
+   BOOST_CHECK(but.pressed());
+   BOOST_CHECK(not but.pressed());
+
+   // Callbacks are once.
+   mock_input(60, 1);
+   eq.run_for(BUTTON_DEBOUNCE * 2);
+   mock_input(60, 0);
+   eq.run_for(BUTTON_DEBOUNCE * 2);
+   BOOST_CHECK_EQUAL(1, button_presses);
+   BOOST_CHECK(not eq.size());
+   mock_virtual_time(false);
+}
+
+BOOST_AUTO_TEST_CASE(test_event_button_leading_edge)
+{
+   mock_virtual_time(true, 1);
+   button_presses = 0;
+   button_releases = 0;
+   mock_input(61, 0);
+   event_queue eq;
+   event_button but(eq, 61, false, true);
+
+   but.on_press(count_press);
+   but.on_release(count_release);
+   eq.run_for(BUTTON_DEBOUNCE * 2);
+
+   // Bouncing press, the first edge is accepted at once.
+   mock_input(61, 1);
+   eq.run_for(MILLIS);
+   BOOST_CHECK_EQUAL(1, button_presses);
+   BOOST_CHECK(but.value());
+   mock_input(61, 0);
+   delayMicroseconds(100);
+   mock_input(61, 1);
+   eq.run_for(BUTTON_DEBOUNCE * 2);
+   BOOST_CHECK(but.value());
+   BOOST_CHECK_EQUAL(0, button_releases);
+
+   // Release is also leading, but an edge right after another waits until stable.
+   mock_input(61, 0);
+   eq.run_for(MILLIS);
+   BOOST_CHECK_EQUAL(1, button_releases);
+   but.on_press(count_press);
+   mock_input(61, 1);
+   delayMicroseconds(100);
+   mock_input(61, 0);
+   eq.run_for(BUTTON_DEBOUNCE * 2);
+   BOOST_CHECK_EQUAL(1, button_presses);
+   BOOST_CHECK(not but.value());
+
+   // A spike after a quiet period is a press, taken back when stable.
+   but.on_release(count_release);
+   mock_input(61, 1);
+   delayMicroseconds(100);
+   mock_input(61, 0);
+   eq.run_for(BUTTON_DEBOUNCE * 2);
+   BOOST_CHECK_EQUAL(2, button_presses);
+   BOOST_CHECK_EQUAL(2, button_releases);
+   BOOST_CHECK(not but.value());
+   mock_virtual_time(false);
+}
+
+BOOST_AUTO_TEST_CASE(test_event_button_polls_without_interrupt)
+{
+   mock_virtual_time(true, 1);
+   button_releases = 0;
+   mock_input(210, 0);
+   event_queue eq;
+   event_button but(eq, 210);
+
+   but.on_release(count_release);
+   mock_input(210, 1);
+   eq.run_for(5 * MILLIS);
+   BOOST_CHECK(but.value());
+   mock_input(210, 0);
+   eq.run_for(5 * MILLIS);
+   BOOST_CHECK_EQUAL(1, button_releases);
+
+   // Stops polling when no callback is waiting.
+   eq.run_for(5 * MILLIS);
+   BOOST_CHECK(not eq.size());
+   mock_virtual_time(false);
+}
@@ -0,0 +1,74 @@
+#include "lib/containers.hpp"
+
+// Hand rolled ring like the ones replaced by ring_buffer, wrapping with modulo of a size only known at runtime (as
+// for a capacity that is not a power of two, or a size passed around as a variable).
+template<typename T, uint16_t capacity>
+struct modulo_ring
+{
+   modulo_ring() : _index(0), _size(0), _capacity(capacity) {}
+
+   inline void push_back(const T& value)
+   {
+      _data[(_index + _size) % _capacity] = value;
+      ++_size;
+   }
+
+   inline T& operator[](uint16_t i) { return _data[(_index + i) % _capacity]; }
+
+   inline void pop_front()
+   {
+      _index = (_index + 1) % _capacity;
+      --_size;
+   }
+
+   T _data[capacity];
+   uint16_t _index;
+   uint16_t _size;
+   volatile uint16_t _capacity;
+};
+
+// Push, read a few back and pop, the pattern of the event queue and run_state history.
+template<typename R>
+void bench_ring(uint32_t n, R& r)
+{
+   uint32_t sum = 0;
+   for (uint32_t i = 0; i < n; ++i) {
+      r.push_back(i);
+      r.push_back(i + 1);
+      sum += r[0] + r[1];
+      r.pop_front();
+      r.pop_front();
+   }
+   bench_keep(sum);
+}
+
+BENCH(ring_modulo)
+{
+   modulo_ring<uint32_t, 16> r;
+   bench_ring(n, r);
+}
+
+BENCH(ring_buffer_masked)
+{
+   ring_buffer<uint32_t, 16> r;
+   bench_ring(n, r);
+}
+
+BENCH(ring_buffer_compare)
+{
+   ring_buffer<uint32_t, 15> r;
+   bench_ring(n, r);
+}
+
+BENCH(spsc_queue_push_pop)
+{
+   spsc_queue<uint32_t, 8> q;
+   uint32_t sum = 0;
+   for (uint32_t i = 0; i < n; ++i) {
+      uint32_t v = 0;
+      q.push(i);
+      q.pop(v);
+      sum += v;
+   }
+   bench_keep(sum);
+}
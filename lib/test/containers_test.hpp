@@ -0,0 +1,174 @@
+#include <string>
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+#include "mock.hpp"
+#include "lib/containers.hpp"
+
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(test_ring_buffer_push_and_pop_at_both_ends_wraps)
+{
+   ring_buffer<int, 4> r;
+   BOOST_CHECK(r.empty());
+   BOOST_CHECK_EQUAL(4, r.max_size());
+
+   // Wrap around a few times.
+   for (int i = 0; i < 10; ++i) {
+      BOOST_CHECK(r.push_back(i));
+      BOOST_CHECK(r.push_back(i + 100));
+      BOOST_CHECK_EQUAL(i, r.front());
+      BOOST_CHECK_EQUAL(i + 100, r.back());
+      r.pop_front();
+      r.pop_front();
+   }
+
+   BOOST_CHECK(r.push_back(2));
+   BOOST_CHECK(r.push_front(1));
+   BOOST_CHECK(r.push_back(3));
+   BOOST_CHECK(r.push_front(0));
+   BOOST_CHECK(r.full());
+   BOOST_CHECK(not r.push_back(4));
+   BOOST_CHECK(not r.push_front(4));
+   for (uint16_t i = 0; i < 4; ++i) {
+      BOOST_CHECK_EQUAL(i, r[i]);
+   }
+
+   r.pop_back();
+   BOOST_CHECK_EQUAL(2, r.back());
+   BOOST_CHECK_EQUAL(3, r.size());
+
+   r.clear();
+   BOOST_CHECK(r.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_buffer_not_power_of_two_wraps)
+{
+   ring_buffer<int, 3> r;
+   BOOST_CHECK_EQUAL(3 * sizeof(int), sizeof(r) - 2 * sizeof(uint16_t));
+
+   for (int i = 0; i < 10; ++i) {
+      BOOST_CHECK(r.push_back(i));
+      BOOST_CHECK(r.push_back(i + 100));
+      BOOST_CHECK_EQUAL(i, r.front());
+      BOOST_CHECK_EQUAL(i + 100, r[1]);
+      r.pop_front();
+      r.pop_front();
+   }
+
+   BOOST_CHECK(r.push_back(1));
+   BOOST_CHECK(r.push_front(0));
+   BOOST_CHECK(r.push_back(2));
+   BOOST_CHECK(not r.push_front(3));
+   for (uint16_t i = 0; i < 3; ++i) {
+      BOOST_CHECK_EQUAL(i, r[i]);
+   }
+
+   ring_buffer<char, 5> c;
+   c.write("abc", 3);
+   c.skip(3);
+   c.write("defg", 4);
+   BOOST_CHECK_EQUAL(2, c.front_span());
+   char buf[5] = {};
+   c.read(buf, 4);
+   BOOST_CHECK_EQUAL(string("defg"), buf);
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_buffer_push_front_overwrite_drops_oldest)
+{
+   ring_buffer<int, 4> r;
+   for (int i = 0; i < 6; ++i) {
+      r.push_front_overwrite(i);
+   }
+   BOOST_CHECK_EQUAL(4, r.size());
+   BOOST_CHECK_EQUAL(5, r[0]);
+   BOOST_CHECK_EQUAL(2, r[3]);
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_buffer_bulk_write_and_read_spanning_end)
+{
+   ring_buffer<char, 8> r;
+   r.write("abcde", 5);
+   r.skip(4);
+   BOOST_CHECK_EQUAL(1, r.size());
+
+   // Writes over the end, front stays contiguous up to the end.
+   r.write("fghij", 5);
+   BOOST_CHECK_EQUAL(6, r.size());
+   BOOST_CHECK_EQUAL(4, r.front_span());
+   BOOST_CHECK_EQUAL('e', r.front());
+
+   char buf[7] = {};
+   r.read(buf, 6);
+   BOOST_CHECK_EQUAL(string("efghij"), buf);
+   BOOST_CHECK(r.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_static_vector)
+{
+   static_vector<string, 3> v;
+   BOOST_CHECK(v.empty());
+   BOOST_CHECK(v.push_back("a"));
+   BOOST_CHECK(v.push_back("b"));
+   BOOST_CHECK(v.push_back("c"));
+   BOOST_CHECK(v.full());
+   BOOST_CHECK(not v.push_back("d"));
+
+   string all;
+   for (auto& s : v) {
+      all += s;
+   }
+   BOOST_CHECK_EQUAL("abc", all);
+
+   v.pop_back();
+   BOOST_CHECK_EQUAL("b", v.back());
+   BOOST_CHECK_EQUAL(2, v.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_spsc_queue_uses_all_slots_and_wraps)
+{
+   spsc_queue<int, 4> q;
+   int v;
+   BOOST_CHECK(not q.pop(v));
+
+   for (int round = 0; round < 100; ++round) {
+      for (int i = 0; i < 4; ++i) {
+         BOOST_CHECK(q.push(round + i));
+      }
+      BOOST_CHECK(not q.push(0));
+      BOOST_CHECK_EQUAL(4, q.size());
+      for (int i = 0; i < 4; ++i) {
+         BOOST_CHECK(q.pop(v));
+         BOOST_CHECK_EQUAL(round + i, v);
+      }
+      BOOST_CHECK(q.empty());
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_spsc_queue_between_threads_keeps_order)
+{
+   spsc_queue<uint32_t, 8> q;
+   const uint32_t count = 200000;
+
+   thread producer([&]() {
+         for (uint32_t i = 0; i < count;) {
+            if (q.push(i)) {
+               ++i;
+            }
+         }
+      });
+
+   bool ordered = true;
+   uint32_t expected = 0;
+   while (expected < count) {
+      uint32_t v;
+      if (q.pop(v)) {
+         ordered = ordered and v == expected;
+         ++expected;
+      }
+   }
+   producer.join();
+   BOOST_CHECK(ordered);
+   BOOST_CHECK(q.empty());
+}
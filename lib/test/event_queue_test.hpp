@@ -53,3 +53,267 @@ BOOST_AUTO_TEST_CASE(test_adding_while_at_max_size_works)
    BOOST_CHECK_EQUAL(EVENTS_SIZE - 1 + 10, result);
 }
 
+
+BOOST_AUTO_TEST_CASE(test_lambda_with_captured_state_works)
+{
+   result = 0;
+   event_queue eq;
+   uint32_t* target = &result;
+   for (uint32_t i = 1; i <= 3; ++i) {
+      eq.enqueue_now([target, i](event_queue& eq, const timestamp_t& when) { *target += i; });
+   }
+   eq.run();
+   BOOST_CHECK_EQUAL(6, result);
+}
+
+struct count_down
+{
+   uint32_t left;
+
+   void operator()(event_queue& eq, const timestamp_t& when)
+   {
+      result++;
+      if (left > 1) {
+         eq.enqueue_now(count_down{left - 1});
+      }
+   }
+
+   bool operator==(const count_down& c) const { return left == c.left; }
+};
+
+BOOST_AUTO_TEST_CASE(test_present_compares_captured_state)
+{
+   result = 0;
+   event_queue eq;
+   eq.enqueue_rel(count_down{4}, MINUTE);
+   eq.enqueue_rel(add_one_once, MINUTE);
+   BOOST_CHECK(eq.present(count_down{4}));
+   BOOST_CHECK(not eq.present(count_down{3}));
+   BOOST_CHECK(eq.present(add_one_once));
+   BOOST_CHECK(not eq.present(add_until_10));
+}
+
+struct stateless
+{
+   void operator()(event_queue& eq, const timestamp_t& when) {}
+};
+
+BOOST_AUTO_TEST_CASE(test_inline_fun_eq_compares_only_the_callable)
+{
+   event_queue::fun_t fun;
+
+   // Bytes left by a larger callable does not matter.
+   uint64_t big = 0xffffffffffffffff;
+   fun.set([big](event_queue& eq, const timestamp_t& when) { result += big; });
+   fun.set(count_down{4});
+   BOOST_CHECK(fun.eq(count_down{4}));
+   BOOST_CHECK(not fun.eq(count_down{3}));
+
+   // Empty callables are equal by type.
+   fun.set(stateless());
+   BOOST_CHECK(fun.eq(stateless()));
+   BOOST_CHECK(not fun.eq(count_down{4}));
+}
+
+BOOST_AUTO_TEST_CASE(test_functor_can_reenqueue_itself_with_new_state)
+{
+   result = 0;
+   event_queue eq;
+   eq.enqueue_now(count_down{5});
+   eq.run();
+   BOOST_CHECK_EQUAL(5, result);
+}
+
+BOOST_AUTO_TEST_CASE(test_small_queue_drops_events_when_full)
+{
+   result = 0;
+   basic_event_queue<3> eq;
+   for (uint32_t i = 0; i < 5; ++i) {
+      eq.enqueue_now([](basic_event_queue<3>& eq, const timestamp_t& when) { result++; });
+   }
+   BOOST_CHECK_EQUAL(3, eq.size());
+   eq.run();
+   BOOST_CHECK_EQUAL(3, result);
+}
+
+BOOST_AUTO_TEST_CASE(test_large_queue_uses_wide_index)
+{
+   using large_queue = basic_event_queue<300>;
+
+   result = 0;
+   large_queue eq;
+   BOOST_CHECK_EQUAL(2, sizeof(eq.size()));
+   for (uint32_t i = 0; i < 300; ++i) {
+      eq.enqueue_at([](large_queue& eq, const timestamp_t& when) { result++; }, now_us() - i);
+   }
+   BOOST_CHECK_EQUAL(300, eq.size());
+   eq.run();
+   BOOST_CHECK_EQUAL(300, result);
+}
+
+BOOST_AUTO_TEST_CASE(test_higher_lane_is_dispatched_first_among_due_events)
+{
+   using lane_queue = basic_event_queue<8, uint8_t, 2>;
+   
+   char order[4] = {0};
+   char* p = order;
+   char** pp = &p;
+   timestamp_t now = now_us();
+   lane_queue eq;
+   eq.enqueue_at([pp](lane_queue& eq, const timestamp_t& when) { *(*pp)++ = 'a'; }, now - 3, 0);
+   eq.enqueue_at([pp](lane_queue& eq, const timestamp_t& when) { *(*pp)++ = 'b'; }, now - 2, 0);
+   eq.enqueue_at([pp](lane_queue& eq, const timestamp_t& when) { *(*pp)++ = 'c'; }, now - 1, 1);
+   eq.run();
+   BOOST_CHECK_EQUAL(string("cab"), string(order));
+}
+
+BOOST_AUTO_TEST_CASE(test_lanes_does_not_affect_events_not_due)
+{
+   using lane_queue = basic_event_queue<8, uint8_t, 2>;
+   
+   char order[3] = {0};
+   char* p = order;
+   char** pp = &p;
+   timestamp_t now = now_us();
+   lane_queue eq;
+   eq.enqueue_at([pp](lane_queue& eq, const timestamp_t& when) { *(*pp)++ = 'a'; }, now - 1, 0);
+   eq.enqueue_at([pp](lane_queue& eq, const timestamp_t& when) { *(*pp)++ = 'b'; }, now + 20 * MILLIS, 1);
+   eq.run();
+   BOOST_CHECK_EQUAL(string("ab"), string(order));
+}
+
+BOOST_AUTO_TEST_CASE(test_idle_jumps_to_deadline_in_virtual_time)
+{
+   mock_virtual_time(true, 1000);
+   result = 0;
+   timestamp_t dispatched = 0;
+   timestamp_t* d = &dispatched;
+   event_queue eq;
+   eq.enqueue_at([d](event_queue& eq, const timestamp_t& when) { *d = now_us(); }, 10 * SECOND);
+   eq.run();
+   mock_virtual_time(false);
+
+   BOOST_CHECK(10 * SECOND <= dispatched);
+   BOOST_CHECK(dispatched < 10 * SECOND + 10);
+}
+
+BOOST_AUTO_TEST_CASE(test_spin_idle_dispatches_on_time)
+{
+   using spin_queue = basic_event_queue<4, uint8_t, 1, spin_idle>;
+   timestamp_t when = now_us() + 20 * MILLIS;
+   timestamp_t dispatched = 0;
+   timestamp_t* d = &dispatched;
+   spin_queue eq;
+   eq.enqueue_at([d](spin_queue& eq, const timestamp_t& when) { *d = now_us(); }, when);
+   eq.run();
+   BOOST_CHECK(when <= dispatched);
+   BOOST_CHECK(dispatched < when + MILLIS);
+}
+
+BOOST_AUTO_TEST_CASE(test_run_once_dispatches_one_due_event)
+{
+   result = 0;
+   timestamp_t now = now_us();
+   event_queue eq;
+   eq.enqueue_at(add_one_once, now - 2);
+   eq.enqueue_at(add_one_once, now - 1);
+   eq.enqueue_at(add_one_once, now + MINUTE);
+
+   auto r = eq.run_once();
+   BOOST_CHECK_EQUAL(1, r.dispatched);
+   BOOST_CHECK_EQUAL(1, result);
+   BOOST_CHECK(r.pending);
+   
+   r = eq.run_once();
+   BOOST_CHECK_EQUAL(1, r.dispatched);
+   BOOST_CHECK_EQUAL(2, result);
+   BOOST_CHECK(r.pending);
+   BOOST_CHECK_EQUAL(now + MINUTE, r.next);
+
+   r = eq.run_once();
+   BOOST_CHECK_EQUAL(0, r.dispatched);
+   BOOST_CHECK_EQUAL(2, result);
+}
+
+BOOST_AUTO_TEST_CASE(test_run_until_dispatches_events_up_to_deadline_in_lock_step)
+{
+   mock_virtual_time(true, 0);
+   result = 0;
+   event_queue eq;
+   for (uint32_t i = 1; i <= 5; ++i) {
+      eq.enqueue_at(add_one_once, i * SECOND);
+   }
+
+   auto r = eq.run_until(2 * SECOND);
+   BOOST_CHECK_EQUAL(2, r.dispatched);
+   BOOST_CHECK_EQUAL(2, result);
+   BOOST_CHECK(r.pending);
+   BOOST_CHECK_EQUAL(3 * SECOND, r.next);
+
+   r = eq.run_for(SECOND + SECOND / 2);
+   BOOST_CHECK_EQUAL(1, r.dispatched);
+   BOOST_CHECK_EQUAL(3, result);
+
+   r = eq.run_until(10 * SECOND);
+   BOOST_CHECK_EQUAL(2, r.dispatched);
+   BOOST_CHECK(not r.pending);
+   mock_virtual_time(false);
+}
+
+struct add_one_obj : event_queue::callback_obj_at
+{
+   void operator()(event_queue& eq, const timestamp_t& when) override
+   {
+      ++result;
+   }
+};
+
+BOOST_AUTO_TEST_CASE(test_run_until_respects_stop_until_reset)
+{
+   mock_virtual_time(true, 0);
+   result = 0;
+   event_queue eq;
+   eq.enqueue_now(add_one_once);
+
+   // Stopped between slices.
+   eq.stop();
+   auto r = eq.run_for(SECOND);
+   BOOST_CHECK_EQUAL(0, r.dispatched);
+   BOOST_CHECK(r.pending);
+   BOOST_CHECK(not eq.running());
+
+   // Stop from a callback ends the slice and stays.
+   eq.reset();
+   eq.enqueue_now([](event_queue& eq, const timestamp_t& when) { eq.stop(); });
+   eq.enqueue_rel(add_one_once, MILLIS);
+   r = eq.run_for(SECOND);
+   BOOST_CHECK_EQUAL(1, r.dispatched);
+   r = eq.run_for(SECOND);
+   BOOST_CHECK_EQUAL(0, r.dispatched);
+   BOOST_CHECK_EQUAL(0, result);
+   mock_virtual_time(false);
+}
+
+BOOST_AUTO_TEST_CASE(test_post_isr_enqueues_before_next_dispatch)
+{
+   mock_virtual_time(true, 0);
+   result = 0;
+   event_queue eq;
+   add_one_obj obj;
+
+   // Queue is empty, but posted events are taken.
+   BOOST_CHECK(eq.post_isr(&obj));
+   BOOST_CHECK(eq.post_isr(&obj));
+   auto r = eq.run_for(SECOND);
+   BOOST_CHECK_EQUAL(2, r.dispatched);
+   BOOST_CHECK_EQUAL(2, result);
+
+   // Room for EVENT_QUEUE_POSTS waiting posts.
+   for (uint8_t i = 0; i < EVENT_QUEUE_POSTS; ++i) {
+      BOOST_CHECK(eq.post_isr(&obj));
+   }
+   BOOST_CHECK(not eq.post_isr(&obj));
+   eq.run_for(SECOND);
+   BOOST_CHECK_EQUAL(2 + EVENT_QUEUE_POSTS, result);
+   mock_virtual_time(false);
+}
@@ -0,0 +1,64 @@
+#include <cstdio>
+
+#include "mock.hpp"
+#include "lib/format.hpp"
+
+// Dividing by 10 per digit, the way noblock_serial used to do it. Host compilers turn the constant division into a
+// multiplication, so the real difference shows on AVR where gcc calls the division routine.
+char* div10_u32(char* end, uint32_t v)
+{
+   do {
+      uint32_t q = v / 10;
+      *--end = '0' + (v - q * 10);
+      v = q;
+   } while (v > 0);
+   return end;
+}
+
+// Spread values over all digit counts.
+inline uint32_t bench_u32(uint32_t i)
+{
+   return (i * 2654435761u) >> (i % 32);
+}
+
+BENCH(u32_snprintf)
+{
+   char buf[FORMAT_BUF_SIZE];
+   for (uint32_t i = 0; i < n; ++i) {
+      snprintf(buf, sizeof(buf), "%u", bench_u32(i));
+      bench_keep(buf);
+   }
+}
+
+BENCH(u32_div10)
+{
+   char buf[FORMAT_BUF_SIZE];
+   for (uint32_t i = 0; i < n; ++i) {
+      bench_keep(div10_u32(buf + sizeof(buf), bench_u32(i)));
+   }
+}
+
+BENCH(u32_format)
+{
+   char buf[FORMAT_BUF_SIZE];
+   for (uint32_t i = 0; i < n; ++i) {
+      bench_keep(format_u32(buf + sizeof(buf), bench_u32(i)));
+   }
+}
+
+BENCH(float_snprintf)
+{
+   char buf[FORMAT_BUF_SIZE];
+   for (uint32_t i = 0; i < n; ++i) {
+      snprintf(buf, sizeof(buf), "%.3f", double(bench_u32(i)) * 1e-4);
+      bench_keep(buf);
+   }
+}
+
+BENCH(float_format)
+{
+   char buf[FORMAT_BUF_SIZE];
+   for (uint32_t i = 0; i < n; ++i) {
+      bench_keep(format_float(buf + sizeof(buf), float(bench_u32(i)) * 1e-4f, 3));
+   }
+}
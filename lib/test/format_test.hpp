@@ -0,0 +1,158 @@
+#include <string>
+#include <random>
+#include <cstdarg>
+
+#include <boost/test/unit_test.hpp>
+
+#include "mock.hpp"
+#include "lib/format.hpp"
+
+using namespace std;
+
+#define FORMAT_STR(fun, v) [&]() {                    \
+      char buf[FORMAT_BUF_SIZE];                         \
+      buf[FORMAT_BUF_SIZE - 1] = '\0';                   \
+      return string(fun(buf + FORMAT_BUF_SIZE - 1, v));  \
+   }()
+
+string format_float(float v, uint8_t precision)
+{
+   char buf[FORMAT_BUF_SIZE];
+   buf[FORMAT_BUF_SIZE - 1] = '\0';
+   return format_float(buf + FORMAT_BUF_SIZE - 1, v, precision);
+}
+
+string printf_str(const char* fmt, ...)
+{
+   char buf[128];
+   va_list args;
+   va_start(args, fmt);
+   vsnprintf(buf, sizeof(buf), fmt, args);
+   va_end(args);
+   return buf;
+}
+
+BOOST_AUTO_TEST_CASE(test_format_4digits_all)
+{
+   for (uint16_t v = 0; v < 10000; ++v) {
+      char buf[4];
+      format_4digits(buf + 4, v);
+      BOOST_REQUIRE_EQUAL(printf_str("%04u", v), string(buf, 4));
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_format_u32_and_i32_edge_cases)
+{
+   vector<uint32_t> values = { 0, 1, 9, 10, 99, 100, 999, 1000, 9999, 10000, 99999, 4294967295u, 4294967294u };
+   for (uint32_t p = 1, i = 0; i < 9; ++i, p *= 10) {
+      values.push_back(p * 10 - 1);
+      values.push_back(p * 10);
+      values.push_back(p * 10 + 1);
+   }
+   for (uint8_t i = 0; i < 32; ++i) {
+      values.push_back((uint32_t(1) << i) - 1);
+      values.push_back(uint32_t(1) << i);
+   }
+
+   for (auto v : values) {
+      BOOST_CHECK_EQUAL(printf_str("%u", v), FORMAT_STR(format_u32, v));
+      BOOST_CHECK_EQUAL(printf_str("%d", int32_t(v)), FORMAT_STR(format_i32, int32_t(v)));
+   }
+   BOOST_CHECK_EQUAL("-2147483648", FORMAT_STR(format_i32, INT32_MIN));
+}
+
+BOOST_AUTO_TEST_CASE(test_format_u32_random)
+{
+   mt19937 gen(4711);
+   for (uint32_t i = 0; i < 1000000; ++i) {
+      uint32_t v = gen() >> (i % 32);
+      BOOST_REQUIRE_EQUAL(printf_str("%u", v), FORMAT_STR(format_u32, v));
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_format_mulhi32_split)
+{
+   mt19937 gen(4711);
+   for (uint32_t i = 0; i < 1000000; ++i) {
+      uint32_t a = gen() >> (i % 32);
+      uint32_t b = i % 2 ? 0xd1b71759 : gen();
+      BOOST_REQUIRE_EQUAL(uint32_t((uint64_t(a) * b) >> 32), format_mulhi32_split(a, b));
+   }
+   BOOST_CHECK_EQUAL(0xfffffffe, format_mulhi32_split(0xffffffff, 0xffffffff));
+}
+
+BOOST_AUTO_TEST_CASE(test_format_u32_min_digits)
+{
+   char buf[12];
+   buf[11] = '\0';
+   BOOST_CHECK_EQUAL("000000042", string(format_u32(buf + 11, 42, 9)));
+   BOOST_CHECK_EQUAL("12345", string(format_u32(buf + 11, 12345, 3)));
+}
+
+BOOST_AUTO_TEST_CASE(test_format_64)
+{
+   vector<uint64_t> values = { 0, 4294967295u, 4294967296u, 999999999999999999u, 1000000000000000000u,
+                               18446744073709551615u };
+   mt19937_64 gen(4711);
+   for (uint32_t i = 0; i < 10000; ++i) {
+      values.push_back(gen() >> (i % 64));
+   }
+
+   for (auto v : values) {
+      BOOST_CHECK_EQUAL(printf_str("%llu", (unsigned long long) v), FORMAT_STR(format_u64, v));
+      BOOST_CHECK_EQUAL(printf_str("%lld", (long long) v), FORMAT_STR(format_i64, int64_t(v)));
+   }
+   BOOST_CHECK_EQUAL("-9223372036854775808", FORMAT_STR(format_i64, INT64_MIN));
+}
+
+BOOST_AUTO_TEST_CASE(test_format_float_edge_cases)
+{
+   vector<float> values = { 0.0f, -0.0f, 0.5f, 1.5f, 2.5f, -2.5f, 0.0005f, 0.0015f, 0.0025f, 0.125f, 0.375f,
+                            1e-10f, 123.456f, 2.1e6f, 1e9f, 2147483520.0f, 2147483648.0f, 4294967296.0f, 1.8e19f, 1e30f, 3.4e38f, -3.4e38f,
+                            INFINITY, -INFINITY, NAN };
+
+   for (uint8_t precision = 0; precision <= FORMAT_MAX_PRECISION; ++precision) {
+      for (auto v : values) {
+         string expected = printf_str("%.*f", precision, double(v));
+         if (fabs(v) >= 18446744073709551616.0f and not isinf(v)) {
+            // Only the high digits are exact.
+            BOOST_CHECK_EQUAL(expected.size(), format_float(v, precision).size());
+            BOOST_CHECK_EQUAL(expected.substr(0, 8), format_float(v, precision).substr(0, 8));
+         }
+         else {
+            BOOST_CHECK_EQUAL(expected, format_float(v, precision));
+         }
+      }
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_format_float_random)
+{
+   mt19937 gen(4711);
+   for (uint32_t i = 0; i < 200000; ++i) {
+      // Random bit patterns below 2^64 (exponent below 191).
+      uint32_t bits = gen() % (uint32_t(191) << 23) | (gen() & 0x80000000);
+      float v;
+      memcpy(&v, &bits, sizeof(v));
+      uint8_t precision = i % (FORMAT_MAX_PRECISION + 1);
+      BOOST_REQUIRE_EQUAL(printf_str("%.*f", precision, double(v)), format_float(v, precision));
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_format_parse)
+{
+   static_assert(format_placeholders("") == 0, "");
+   static_assert(format_placeholders("a {} b {}{}") == 3, "");
+   static_assert(format_placeholders("{ } {x}") == 0, "");
+
+   constexpr auto s = format_parse("pos {} target {}{}\n", format_make_indices<4>::type());
+   static_assert(s.segment[0].start == 0 and s.segment[0].len == 4, "");
+   static_assert(s.segment[1].start == 6 and s.segment[1].len == 8, "");
+   static_assert(s.segment[2].start == 16 and s.segment[2].len == 0, "");
+   static_assert(s.segment[3].start == 18 and s.segment[3].len == 1, "");
+
+   constexpr auto e = format_parse("{}", format_make_indices<2>::type());
+   BOOST_CHECK_EQUAL(0, e.segment[0].len);
+   BOOST_CHECK_EQUAL(2, e.segment[1].start);
+   BOOST_CHECK_EQUAL(0, e.segment[1].len);
+}
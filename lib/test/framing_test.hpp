@@ -0,0 +1,47 @@
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+#include "mock.hpp"
+#include "lib/framing.hpp"
+
+using namespace std;
+
+string cobs(const vector<uint8_t>& data)
+{
+   vector<uint8_t> out(cobs_max_size(data.size()));
+   uint16_t len = cobs_encode(data.data(), data.size(), out.data());
+   BOOST_CHECK(len <= out.size());
+   return string(out.begin(), out.begin() + len);
+}
+
+BOOST_AUTO_TEST_CASE(test_crc8)
+{
+   const char* check = "123456789";
+   BOOST_CHECK_EQUAL(0xf4, crc8(reinterpret_cast<const uint8_t*>(check), 9));
+   BOOST_CHECK_EQUAL(0xf4, crc8(reinterpret_cast<const uint8_t*>(check) + 4, 5,
+                                crc8(reinterpret_cast<const uint8_t*>(check), 4)));
+}
+
+BOOST_AUTO_TEST_CASE(test_cobs_encode)
+{
+   BOOST_CHECK_EQUAL(string("\x01", 1), cobs({}));
+   BOOST_CHECK_EQUAL(string("\x01\x01", 2), cobs({0}));
+   BOOST_CHECK_EQUAL(string("\x01\x01\x01", 3), cobs({0, 0}));
+   BOOST_CHECK_EQUAL(string("\x03\x11\x22\x02\x33", 5), cobs({0x11, 0x22, 0, 0x33}));
+   BOOST_CHECK_EQUAL(string("\x05\x11\x22\x33\x44", 5), cobs({0x11, 0x22, 0x33, 0x44}));
+   BOOST_CHECK_EQUAL(string("\x02\x11\x01\x01\x01", 5), cobs({0x11, 0, 0, 0}));
+}
+
+BOOST_AUTO_TEST_CASE(test_cobs_encode_long_run)
+{
+   vector<uint8_t> data;
+   for (uint16_t i = 1; i <= 300; ++i) {
+      data.push_back(i % 255 ? i % 255 : 1);
+   }
+   string out = cobs(data);
+   BOOST_CHECK_EQUAL(302, out.size());
+   BOOST_CHECK_EQUAL(0xff, uint8_t(out[0]));
+   BOOST_CHECK_EQUAL(47, uint8_t(out[255]));
+   BOOST_CHECK_EQUAL(string::npos, out.find('\0'));
+}
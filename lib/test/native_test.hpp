@@ -0,0 +1,44 @@
+#include <boost/test/unit_test.hpp>
+
+#include "mock.hpp"
+
+int native_test_edges = 0;
+
+void native_test_count_edge()
+{
+   ++native_test_edges;
+}
+
+BOOST_AUTO_TEST_CASE(test_native_scripted_inputs_fire_interrupts_in_time)
+{
+   mock_virtual_time(true, 0);
+   native_test_edges = 0;
+   pin_values[150] = 0;
+   attachInterrupt(150, native_test_count_edge, CHANGE);
+
+   native_script_input(200, 150, 0);
+   native_script_input(100, 150, 1);
+   native_script_input(300, 150, 0);
+
+   delayMicroseconds(99);
+   micros();
+   BOOST_CHECK_EQUAL(0, native_test_edges);
+   micros();
+   BOOST_CHECK_EQUAL(1, native_test_edges);
+   BOOST_CHECK_EQUAL(1, digitalRead(150));
+
+   // Same value again is not an edge.
+   delayMicroseconds(1000);
+   micros();
+   BOOST_CHECK_EQUAL(2, native_test_edges);
+   BOOST_CHECK(native_inputs.empty());
+
+   detachInterrupt(150);
+   mock_virtual_time(false);
+}
+
+BOOST_AUTO_TEST_CASE(test_native_map)
+{
+   BOOST_CHECK_EQUAL(512, ::map(50, 0, 100, 0, 1024));
+   BOOST_CHECK_EQUAL(-10, ::map(0, 0, 10, -10, 10));
+}
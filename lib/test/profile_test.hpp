@@ -0,0 +1,46 @@
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+#include "mock.hpp"
+#include "lib/util.hpp"
+#include "lib/event_queue.hpp"
+#include "lib/serial.hpp"
+#include "lib/profile.hpp"
+
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(test_profile_site_stats)
+{
+   // Sites are registered in a global list, so it needs static storage.
+   static profile_site site("test");
+   site.add(10);
+   site.add(30);
+   site.add(20);
+
+   BOOST_CHECK_EQUAL(3, site.count);
+   BOOST_CHECK_EQUAL(10, site.min);
+   BOOST_CHECK_EQUAL(20, site.mean());
+   BOOST_CHECK_EQUAL(30, site.max);
+
+   {
+      profile_scope scope(site);
+      usleep(1000);
+   }
+   BOOST_CHECK_EQUAL(4, site.count);
+   BOOST_CHECK(site.max >= 1000000);
+
+   mock_virtual_time(true, 1);
+   Serial.reset();
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+
+   profile_reset();
+   site.add(5);
+   profile_dump(s);
+   eq.run_for(SECOND);
+   Serial.flush();
+   BOOST_CHECK(Serial.output.find("test count 1 min 5 mean 5 max 5 ns\n") != string::npos);
+
+   mock_virtual_time(false);
+}
@@ -1,4 +1,6 @@
 #include <string>
+#include <thread>
+#include <atomic>
 
 #include <boost/test/unit_test.hpp>
 
@@ -9,7 +11,7 @@ using namespace std;
 
 BOOST_AUTO_TEST_CASE(test_ang_1024)
 {
-   rotary_encoder<0, 0, 1024> encoder;
+   rotary_encoder<1024> encoder(0, 0);
    
    encoder.reset(0);
    BOOST_CHECK_EQUAL(0, encoder.ang());
@@ -41,7 +43,7 @@ BOOST_AUTO_TEST_CASE(test_ang_1024)
 
 BOOST_AUTO_TEST_CASE(test_ang_200)
 {
-   rotary_encoder<0, 0, 200> encoder;
+   rotary_encoder<200> encoder(0, 0);
    
    encoder.reset(0);
    BOOST_CHECK_EQUAL(0, encoder.ang());
@@ -58,3 +60,312 @@ BOOST_AUTO_TEST_CASE(test_ang_200)
    encoder.reset(99);
    BOOST_CHECK_EQUAL(99, encoder.ang());
 }
+
+// Move encoder one full quadrature cycle (4 edges) forward or backward.
+void encoder_cycle(pin_t a, pin_t b, bool forward)
+{
+   const uint8_t seq[] = { 0b10, 0b11, 0b01, 0b00 };
+   for (uint8_t i = 0; i < 4; ++i) {
+      uint8_t s = seq[forward ? i : (6 - i) % 4];
+      if (bool(s & 2) != bool(pin_values[a])) {
+         mock_input(a, s >> 1);
+      }
+      if (bool(s & 1) != bool(pin_values[b])) {
+         mock_input(b, s & 1);
+      }
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_x2)
+{
+   mock_input(20, 0);
+   mock_input(21, 0);
+   rotary_encoder<200> encoder(20, 21);
+
+   encoder_cycle(20, 21, true);
+   BOOST_CHECK_EQUAL(2, encoder.raw());
+   encoder_cycle(20, 21, false);
+   encoder_cycle(20, 21, false);
+   BOOST_CHECK_EQUAL(-2, encoder.ang());
+   BOOST_CHECK_EQUAL(-1, encoder.lap());
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_x4)
+{
+   mock_input(22, 0);
+   mock_input(23, 0);
+   rotary_encoder<400, encoder_mode::X4> encoder(22, 23);
+
+   encoder_cycle(22, 23, true);
+   BOOST_CHECK_EQUAL(4, encoder.raw());
+   encoder_cycle(22, 23, false);
+   encoder_cycle(22, 23, false);
+   BOOST_CHECK_EQUAL(-4, encoder.ang());
+   BOOST_CHECK_EQUAL(-1, encoder.lap());
+   BOOST_CHECK_EQUAL(0, encoder.invalid());
+
+   // Both channels change between interrupts, not counted.
+   pin_values[22] = 1;
+   mock_input(23, 1);
+   BOOST_CHECK_EQUAL(-4, encoder.ang());
+   BOOST_CHECK_EQUAL(1, encoder.invalid());
+}
+
+// Move encoder one edge forward or backward.
+void encoder_edge(pin_t a, pin_t b, bool forward)
+{
+   const uint8_t seq[] = { 0b00, 0b10, 0b11, 0b01 };
+   uint8_t s = pin_values[a] << 1 | pin_values[b];
+   uint8_t i = find(seq, seq + 4, s) - seq;
+   uint8_t n = seq[(i + (forward ? 1 : 3)) % 4];
+   if (n >> 1 != pin_values[a]) {
+      mock_input(a, n >> 1);
+   }
+   else {
+      mock_input(b, n & 1);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_velocity)
+{
+   mock_virtual_time(true, 1);
+   mock_input(24, 0);
+   mock_input(25, 0);
+   rotary_encoder<400, encoder_mode::X4, 8> encoder(24, 25);
+
+   BOOST_CHECK_EQUAL(0, encoder.velocity(micros()));
+   
+   // Slow, one edge per 4 ms, the window only covers the last period.
+   for (uint8_t i = 0; i < 3; ++i) {
+      delayMicroseconds(4000);
+      encoder_edge(24, 25, true);
+   }
+   BOOST_CHECK_CLOSE(250.0, encoder.velocity(micros()), 1);
+
+   // No edges for 20 ms, at most one tick since last edge.
+   delayMicroseconds(20000);
+   BOOST_CHECK_CLOSE(50.0, encoder.velocity(micros()), 1);
+
+   // Fast backwards, one edge per 100 us, over all stored edges.
+   for (uint8_t i = 0; i < 20; ++i) {
+      delayMicroseconds(100);
+      encoder_edge(24, 25, false);
+   }
+   BOOST_CHECK_CLOSE(-10000.0, encoder.velocity(micros()), 1);
+
+   delayMicroseconds(ENCODER_VELOCITY_TIMEOUT);
+   BOOST_CHECK_EQUAL(0, encoder.velocity(micros()));
+   mock_virtual_time(false);
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot_consistent_with_concurrent_interrupts)
+{
+   mock_input(26, 0);
+   mock_input(27, 0);
+   rotary_encoder<16, encoder_mode::X4, 4> encoder(26, 27);
+
+   // Interrupts from another thread, forward only so lap and raw together always increase.
+   atomic<bool> done(false);
+   thread isr([&] {
+      for (uint32_t i = 0; i < 200000; ++i) {
+         encoder_edge(26, 27, true);
+      }
+      done = true;
+   });
+
+   int64_t last = 0;
+   uint32_t reads = 0;
+   bool consistent = true;
+   while (not done) {
+      auto s = encoder.snapshot();
+      int64_t total = int64_t(s.lap) * 16 + s.raw;
+      consistent = consistent and s.raw >= 0 and s.raw < 16 and total >= last;
+      last = total;
+      ++reads;
+   }
+   isr.join();
+
+   BOOST_CHECK(consistent);
+   BOOST_CHECK(reads > 0);
+   BOOST_CHECK_EQUAL(200000, int64_t(encoder.lap()) * 16 + encoder.raw());
+}
+
+BOOST_AUTO_TEST_CASE(test_independent_encoders)
+{
+   pin_modes[13] = INPUT;
+   mock_input(30, 0);
+   mock_input(31, 0);
+   mock_input(32, 0);
+   mock_input(33, 0);
+   rotary_encoder<100, encoder_mode::X4> pendulum(30, 31);
+   rotary_encoder<100, encoder_mode::X4> cart(32, 33);
+
+   encoder_cycle(30, 31, true);
+   encoder_cycle(32, 33, false);
+   encoder_cycle(32, 33, false);
+
+   BOOST_CHECK_EQUAL(4, pendulum.ang());
+   BOOST_CHECK_EQUAL(-8, cart.ang());
+   BOOST_CHECK_EQUAL(INPUT, pin_modes[13]);
+
+   // Fill the rest of the slots.
+   auto dummy = [](void*) {};
+   for (uint8_t i = 4; i < INTERRUPT_SLOTS; ++i) {
+      BOOST_CHECK(attach_interrupt(50 + i, dummy, nullptr, CHANGE));
+   }
+   BOOST_CHECK(not attach_interrupt(34, dummy, nullptr, CHANGE));
+   for (uint8_t i = 4; i < INTERRUPT_SLOTS; ++i) {
+      detach_interrupt(50 + i);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_index)
+{
+   mock_input(40, 0);
+   mock_input(41, 0);
+   mock_input(42, 0);
+   rotary_encoder<100, encoder_mode::X4> encoder(40, 41);
+   encoder.index(42, 50);
+
+   // Start at unknown angle, first pulse sets the raw angle.
+   encoder.reset(10);
+   encoder_edge(40, 41, true);
+   BOOST_CHECK(not encoder.indexed());
+   mock_input(42, 1);
+   mock_input(42, 0);
+   BOOST_CHECK(encoder.indexed());
+   BOOST_CHECK_EQUAL(-39, encoder.index_error());
+   BOOST_CHECK_EQUAL(50, encoder.raw());
+
+   // A revolution with 3 missed edges is corrected.
+   encoder.reset(47, 0);
+   mock_input(42, 1);
+   mock_input(42, 0);
+   BOOST_CHECK_EQUAL(-3, encoder.index_error());
+   BOOST_CHECK_EQUAL(50, encoder.raw());
+   BOOST_CHECK_EQUAL(0, encoder.lap());
+
+   // Within tolerance, not corrected.
+   encoder.reset(51, 0);
+   mock_input(42, 1);
+   mock_input(42, 0);
+   BOOST_CHECK_EQUAL(1, encoder.index_error());
+   BOOST_CHECK_EQUAL(51, encoder.raw());
+}
+
+BOOST_AUTO_TEST_CASE(test_index_correction_over_zero_adjusts_lap)
+{
+   mock_input(43, 0);
+   mock_input(44, 0);
+   mock_input(45, 0);
+   rotary_encoder<100, encoder_mode::X4> encoder(43, 44);
+   encoder.index(45, 1);
+
+   encoder.reset(98, 3);
+   mock_input(45, 1);
+   BOOST_CHECK_EQUAL(-3, encoder.index_error());
+   BOOST_CHECK_EQUAL(1, encoder.raw());
+   BOOST_CHECK_EQUAL(4, encoder.lap());
+
+   encoder.reset(3, 4);
+   mock_input(45, 0);
+   mock_input(45, 1);
+   BOOST_CHECK_EQUAL(2, encoder.index_error());
+   BOOST_CHECK_EQUAL(1, encoder.raw());
+   BOOST_CHECK_EQUAL(4, encoder.lap());
+
+   encoder.reset(0, 4);
+   mock_input(45, 0);
+   mock_input(45, 1);
+   BOOST_CHECK_EQUAL(-1, encoder.index_error());
+   BOOST_CHECK_EQUAL(0, encoder.raw());
+}
+
+BOOST_AUTO_TEST_CASE(test_glitch_filter)
+{
+   mock_virtual_time(true, 1);
+   mock_input(46, 0);
+   mock_input(47, 0);
+   rotary_encoder<100, encoder_mode::X4> encoder(46, 47);
+   encoder.filter(50);
+
+   delayMicroseconds(100);
+   encoder_edge(46, 47, true);
+   BOOST_CHECK_EQUAL(1, encoder.raw());
+
+   // Short pulse on b right after, dropped.
+   mock_input(47, 1);
+   mock_input(47, 0);
+   BOOST_CHECK_EQUAL(1, encoder.raw());
+   BOOST_CHECK_EQUAL(1, encoder.glitches());
+
+   // An edge and straight back is a pulse too.
+   delayMicroseconds(100);
+   encoder_edge(46, 47, true);
+   encoder_edge(46, 47, false);
+   BOOST_CHECK_EQUAL(1, encoder.raw());
+   BOOST_CHECK_EQUAL(2, encoder.glitches());
+
+   delayMicroseconds(100);
+   encoder_edge(46, 47, true);
+   BOOST_CHECK_EQUAL(2, encoder.raw());
+   BOOST_CHECK_EQUAL(0, encoder.invalid());
+   mock_virtual_time(false);
+}
+
+BOOST_AUTO_TEST_CASE(test_glitch_filter_isolated_pulse)
+{
+   mock_virtual_time(true, 1);
+   mock_input(50, 0);
+   mock_input(51, 0);
+   rotary_encoder<100, encoder_mode::X4, 4> encoder(50, 51);
+   encoder.filter(50);
+
+   delayMicroseconds(1000);
+   encoder_edge(50, 51, true);
+   uint32_t when = encoder.snapshot().when;
+
+   // A 5 us pulse on b long after the last edge, the first edge is counted until the second takes it back.
+   delayMicroseconds(1000);
+   mock_input(51, 1);
+   delayMicroseconds(5);
+   mock_input(51, 0);
+   BOOST_CHECK_EQUAL(1, encoder.raw());
+   BOOST_CHECK_EQUAL(when, encoder.snapshot().when);
+   BOOST_CHECK_EQUAL(1, encoder.glitches());
+
+   delayMicroseconds(1000);
+   encoder_edge(50, 51, false);
+   BOOST_CHECK_EQUAL(0, encoder.raw());
+   BOOST_CHECK_EQUAL(0, encoder.invalid());
+
+   // Overlapping pulses on both channels look like a full turn of quadrature states, each pulse is dropped.
+   delayMicroseconds(1000);
+   mock_input(50, 1);
+   mock_input(51, 1);
+   mock_input(50, 0);
+   mock_input(51, 0);
+   BOOST_CHECK_EQUAL(0, encoder.raw());
+   BOOST_CHECK_EQUAL(3, encoder.glitches());
+
+   delayMicroseconds(1000);
+   encoder_edge(50, 51, false);
+   BOOST_CHECK_EQUAL(99, encoder.raw());
+   BOOST_CHECK_EQUAL(0, encoder.invalid());
+   mock_virtual_time(false);
+}
+
+BOOST_AUTO_TEST_CASE(test_x2_rejects_interrupt_without_change)
+{
+   mock_input(48, 0);
+   mock_input(49, 0);
+   rotary_encoder<100> encoder(48, 49);
+
+   mock_input(48, 1);
+   BOOST_CHECK_EQUAL(1, encoder.raw());
+   
+   // Interrupt but a is read back at the same level (pulse shorter than interrupt latency).
+   interrupt_handlers[48]();
+   BOOST_CHECK_EQUAL(1, encoder.raw());
+   BOOST_CHECK_EQUAL(1, encoder.invalid());
+}
@@ -0,0 +1,29 @@
+#include <chrono>
+#include <cstdio>
+
+#include "bench.hpp"
+
+#include "format_bench.hpp"
+#include "serial_bench.hpp"
+#include "containers_bench.hpp"
+
+int main()
+{
+   using namespace std::chrono;
+
+   for (auto& c : bench_cases()) {
+      uint32_t n = 1000;
+      double elapsed;
+      while (true) {
+         auto start = steady_clock::now();
+         c.fun(n);
+         elapsed = duration<double>(steady_clock::now() - start).count();
+         if (elapsed > 0.2) {
+            break;
+         }
+         n *= 2;
+      }
+      printf("%-32s %10.1f ns/op\n", c.name, elapsed * 1e9 / n);
+   }
+   return 0;
+}
@@ -6,3 +6,12 @@
 #include "event_queue_test.hpp"
 #include "stepper_test.hpp"
 #include "rotary_encoder_test.hpp"
+#include "framing_test.hpp"
+#include "format_test.hpp"
+#include "serial_test.hpp"
+#include "trace_test.hpp"
+#include "telemetry_test.hpp"
+#include "profile_test.hpp"
+#include "button_test.hpp"
+#include "containers_test.hpp"
+#include "native_test.hpp"
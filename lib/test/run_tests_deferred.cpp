@@ -0,0 +1,8 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE run_tests_deferred
+#include <boost/test/unit_test.hpp>
+
+// Serial tests again with formatting deferred to the drain (see SERIAL_DEFERRED in lib/serial.hpp).
+#define SERIAL_DEFERRED 1
+
+#include "serial_test.hpp"
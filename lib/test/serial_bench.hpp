@@ -0,0 +1,34 @@
+#include "mock.hpp"
+#include "lib/util.hpp"
+#include "lib/event_queue.hpp"
+#include "lib/serial.hpp"
+
+// Cost of a log line, hw is instant so the line goes straight to the (mock) hw buffer.
+template<typename F>
+void bench_serial_lines(uint32_t n, F line)
+{
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+   Serial.reset(1024);
+   Serial.baud_rate = 0;
+   for (uint32_t i = 0; i < n; ++i) {
+      line(s, i);
+      if (Serial.output.size() > 4096) {
+         Serial.output.clear();
+      }
+   }
+}
+
+BENCH(serial_p_line)
+{
+   bench_serial_lines(n, [](noblock_serial& s, uint32_t i) {
+         s.p("balancing, pos ", int32_t(i), ", new_target ", int32_t(i + 7), " up_ang ", int16_t(-12), "\n");
+      });
+}
+
+BENCH(serial_f_line)
+{
+   bench_serial_lines(n, [](noblock_serial& s, uint32_t i) {
+         SERIAL_F(s, "balancing, pos {}, new_target {} up_ang {}\n", int32_t(i), int32_t(i + 7), int16_t(-12));
+      });
+}
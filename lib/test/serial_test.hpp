@@ -0,0 +1,281 @@
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+#include "mock.hpp"
+#include "lib/util.hpp"
+#include "lib/event_queue.hpp"
+#include "lib/serial.hpp"
+#include "lib/params.hpp"
+
+using namespace std;
+
+struct serial_fixture
+{
+   serial_fixture()
+   {
+      mock_virtual_time(true, 1);
+      Serial.reset();
+   }
+
+   ~serial_fixture()
+   {
+      mock_virtual_time(false);
+   }
+};
+
+BOOST_AUTO_TEST_CASE(test_serial_print_values)
+{
+   serial_fixture f;
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+
+   char buf[8] = "buf";
+   const char cbuf[32] = "cbuf";
+   s.p("a ", 12, " ", -3, " ", 1.5f, " ", true, " ", buf, " ", cbuf, " ", 4000000000u, '\n');
+   s.precision(1).p(2.25f, "\n");
+   eq.run_for(SECOND);
+   Serial.flush();
+
+   BOOST_CHECK_EQUAL("a 12 -3 1.500 true buf cbuf 4000000000\n2.2\n", Serial.output);
+}
+
+BOOST_AUTO_TEST_CASE(test_serial_print_flash_strings)
+{
+   serial_fixture f;
+   Serial.reset(8);
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+
+   // Longer than the hw buffer so it is drained from flash in several steps.
+   s.p(F("from flash, "), 7, F(" and more\n"));
+   SERIAL_F(s, "{}{}\n", F("fmt "), 1);
+   eq.run_for(SECOND);
+   Serial.flush();
+
+   BOOST_CHECK_EQUAL("from flash, 7 and more\nfmt 1\n", Serial.output);
+}
+
+BOOST_AUTO_TEST_CASE(test_serial_format_string)
+{
+   serial_fixture f;
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+
+   int16_t pos = -5;
+   SERIAL_F(s, "pos {} target {}{}\n", pos, uint8_t(200), " end");
+   SERIAL_F(s, "no args\n");
+   eq.run_for(SECOND);
+   Serial.flush();
+
+   BOOST_CHECK_EQUAL("pos -5 target 200 end\nno args\n", Serial.output);
+}
+
+BOOST_AUTO_TEST_CASE(test_serial_backpressure_keeps_order_with_few_dispatches)
+{
+   serial_fixture f;
+   Serial.reset(16);
+   event_queue eq;
+   noblock_serial s(&eq, 9600);
+
+   string expected;
+   for (uint32_t i = 0; i < 20; ++i) {
+      s.p("line ", i, ", some text\n");
+      expected += "line " + to_string(i) + ", some text\n";
+   }
+   auto r = eq.run_for(2 * SECOND);
+   Serial.flush();
+
+   BOOST_CHECK_EQUAL(expected, Serial.output);
+
+   // One byte is 1 ms at 9600, the drain should wake up about once per 12 bytes, not once per byte.
+   BOOST_CHECK(r.dispatched < expected.size() / 8);
+   BOOST_CHECK(r.dispatched > expected.size() / 16);
+}
+
+BOOST_AUTO_TEST_CASE(test_serial_clear_then_print_literal)
+{
+   serial_fixture f;
+   Serial.reset(8);
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+
+   // Fills the hw buffer (in deferred mode when drained), the next print waits in the sw buffer and is cleared.
+   s.p(12345678);
+   eq.run_once();
+   s.p(1234);
+   s.clear();
+   s.p(56);
+   s.p("end");
+   eq.run_for(SECOND);
+   Serial.flush();
+
+   BOOST_CHECK_EQUAL("1234567856end", Serial.output);
+}
+
+BOOST_AUTO_TEST_CASE(test_serial_log_levels_and_drop_report)
+{
+   serial_fixture f;
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+
+   // Fill the buffer more than half.
+   uint8_t data[600];
+   memset(data, '.', sizeof(data));
+   BOOST_CHECK(s.write(data, sizeof(data)));
+
+   s.log(log_level::DEBUG, "debug\n");
+   s.log(log_level::INFO, "info\n");
+   s.log(log_level::ERROR, "error\n");
+
+   log_site site(2);
+   for (uint8_t i = 0; i < 5; ++i) {
+      s.log(site, log_level::WARN, "limited\n");
+   }
+
+   eq.run_for(3 * SECOND);
+   Serial.flush();
+
+   // Rate limited messages are not drops.
+   BOOST_CHECK_EQUAL(string(sizeof(data), '.') + "info\nerror\nlimited\nlimited\n"
+                     "dropped messages, debug 1, info 0, warn 0, error 0\n", Serial.output);
+   BOOST_CHECK_EQUAL(3, site.suppressed());
+}
+
+// Logs a debug message every 5 ms, faster than it can be printed.
+struct debug_flood
+{
+   noblock_serial* s;
+
+   void operator()(event_queue& eq, const timestamp_t& when)
+   {
+      s->log(log_level::DEBUG, "debug message\n");
+      eq.enqueue_at(*this, when + 5 * MILLIS);
+   }
+};
+
+BOOST_AUTO_TEST_CASE(test_serial_drop_report_under_steady_load)
+{
+   serial_fixture f;
+   Serial.reset(16);
+   event_queue eq;
+   noblock_serial s(&eq, 9600);
+
+   // The buffer stays half full with debug messages and never runs empty.
+   eq.enqueue_now(debug_flood{&s});
+   eq.run_for(3 * SECOND);
+
+   string report = "dropped messages, debug ";
+   uint32_t reports = 0;
+   for (size_t i = Serial.output.find(report); i != string::npos; i = Serial.output.find(report, i + 1)) {
+      ++reports;
+   }
+   BOOST_CHECK(reports >= 1);
+   BOOST_CHECK(reports <= 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_serial_read_line)
+{
+   serial_fixture f;
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+
+   string in = "set x 1\r\nfoo";
+   Serial.input.assign(in.begin(), in.end());
+
+   BOOST_CHECK_EQUAL("set x 1", s.read_line());
+   BOOST_CHECK(s.read_line() == nullptr);
+   Serial.input.push_back('\n');
+   BOOST_CHECK_EQUAL("foo", s.read_line());
+   BOOST_CHECK(s.read_line() == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(test_params)
+{
+   serial_fixture f;
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+   params params(eq, s);
+
+   float kp = 1.0;
+   uint32_t tick = 10000;
+   int16_t dist = -3;
+   params.add("kp", kp);
+   params.add("tick", tick);
+   params.add("dist", dist);
+
+   BOOST_CHECK(params.set("kp", "0.5"));
+   BOOST_CHECK_EQUAL(0.5, kp);
+   BOOST_CHECK(not params.set("kp", "x"));
+   BOOST_CHECK(not params.set("nope", "1"));
+
+   // Out of range for the type is refused, not wrapped.
+   BOOST_CHECK(not params.set("tick", "-1"));
+   BOOST_CHECK(not params.set("tick", "4294967296"));
+   BOOST_CHECK(params.set("tick", "4294967295"));
+   BOOST_CHECK_EQUAL(4294967295u, tick);
+   BOOST_CHECK(not params.set("dist", "70000"));
+   BOOST_CHECK(not params.set("dist", "-32769"));
+   BOOST_CHECK(params.set("dist", "-32768"));
+   BOOST_CHECK_EQUAL(-32768, dist);
+   BOOST_CHECK(not params.set("kp", "1e39"));
+   BOOST_CHECK_EQUAL(0.5, kp);
+   BOOST_CHECK(params.set("dist", "-3"));
+
+   string in = "set tick 20000\nget dist\nlist\nbad\n";
+   Serial.input.assign(in.begin(), in.end());
+   params.start();
+   eq.run_for(SECOND / 10);
+   Serial.flush();
+
+   BOOST_CHECK_EQUAL(20000, tick);
+   BOOST_CHECK_EQUAL("tick 20000\n"
+                     "dist -3\n"
+                     "kp 0.500\ntick 20000\ndist -3\n"
+                     "unknown command bad, use list, get <name> or set <name> <value>\n", Serial.output);
+}
+
+BOOST_AUTO_TEST_CASE(test_params_replies_outlive_the_line)
+{
+   serial_fixture f;
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+   params params(eq, s);
+
+   // The reply names are in the line buffer, which is reused for the next line before the output is drained.
+   string in = "get alpha\nget beta\nfoo\nset gamma 1\n";
+   Serial.input.assign(in.begin(), in.end());
+   params.start();
+   eq.run_for(SECOND / 10);
+   Serial.flush();
+
+   BOOST_CHECK_EQUAL("no param alpha\nno param beta\n"
+                     "unknown command foo, use list, get <name> or set <name> <value>\n"
+                     "failed to set gamma\n", Serial.output);
+}
+
+BOOST_AUTO_TEST_CASE(test_serial_pty)
+{
+   serial_fixture f;
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+
+   const char* path = Serial.open_pty();
+   BOOST_REQUIRE(path);
+   int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+   BOOST_REQUIRE(fd >= 0);
+
+   s.p("hello\n");
+   eq.run_for(SECOND / 10);
+   Serial.flush();
+   usleep(10000);
+   char buf[16] = {};
+   BOOST_CHECK_EQUAL(6, ::read(fd, buf, sizeof(buf)));
+   BOOST_CHECK_EQUAL("hello\n", string(buf));
+
+   BOOST_CHECK_EQUAL(4, ::write(fd, "ok\r\n", 4));
+   usleep(10000);
+   BOOST_CHECK_EQUAL("ok", s.read_line());
+   close(fd);
+   Serial.close_pty();
+}
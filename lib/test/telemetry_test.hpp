@@ -0,0 +1,36 @@
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+#include "mock.hpp"
+#include "lib/util.hpp"
+#include "lib/event_queue.hpp"
+#include "lib/telemetry.hpp"
+
+using namespace std;
+
+// Uses decode_frames from trace_test.hpp.
+
+BOOST_AUTO_TEST_CASE(test_telemetry_message_describes_and_sends_its_fields)
+{
+   mock_virtual_time(true, 1);
+   Serial.reset(256);
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+   telemetry tm(s);
+   const telemetry_message<7, uint32_t, int16_t> msg("tick", "tick,ang");
+
+   BOOST_CHECK(tm.describe(msg));
+   BOOST_CHECK(tm.send(msg, uint32_t(5), int16_t(-2)));
+   eq.run_for(SECOND);
+   Serial.flush();
+
+   auto frames = decode_frames(Serial.output);
+   BOOST_REQUIRE_EQUAL(2, frames.size());
+   BOOST_CHECK_EQUAL(0, frames[0].first);
+   BOOST_CHECK_EQUAL(string("\7tick\0Ih\0tick,ang", 17), frames[0].second);
+   BOOST_CHECK_EQUAL(7, frames[1].first);
+   BOOST_CHECK_EQUAL(string("\5\0\0\0\xfe\xff", 6), frames[1].second);
+
+   mock_virtual_time(false);
+}
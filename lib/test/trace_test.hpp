@@ -0,0 +1,85 @@
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "mock.hpp"
+#include "lib/util.hpp"
+#include "lib/event_queue.hpp"
+#include "lib/trace.hpp"
+
+using namespace std;
+
+// Decode zero delimited COBS frames (without crc check), returns payloads by type.
+vector<pair<uint8_t, string>> decode_frames(const string& data)
+{
+   vector<pair<uint8_t, string>> frames;
+   string frame;
+   for (char c : data) {
+      if (c != 0) {
+         frame += c;
+         continue;
+      }
+      string out;
+      for (size_t i = 0; i < frame.size();) {
+         uint8_t code = frame[i];
+         out += frame.substr(i + 1, code - 1);
+         i += code;
+         if (code < 0xff and i < frame.size()) {
+            out += '\0';
+         }
+      }
+      if (out.size() >= 2) {
+         frames.push_back({uint8_t(out[0]), out.substr(1, out.size() - 2)});
+      }
+      frame.clear();
+   }
+   return frames;
+}
+
+BOOST_AUTO_TEST_CASE(test_trace_dump)
+{
+   mock_virtual_time(true, 1);
+   Serial.reset(64);
+   event_queue eq;
+   noblock_serial s(&eq, 115200);
+   telemetry tm(s);
+   tracer<8> trace(eq, tm);
+
+   uint8_t tick = trace.name("tick");
+   uint8_t pos = trace.name("pos");
+   BOOST_CHECK_EQUAL(tick, trace.name("tick"));
+
+   for (int32_t i = 0; i < 10; ++i) {
+      trace.begin(tick);
+      trace.counter(pos, i);
+      trace.end(tick);
+   }
+
+   trace.dump();
+   eq.run_for(SECOND);
+   Serial.flush();
+
+   auto frames = decode_frames(Serial.output);
+   BOOST_REQUIRE_EQUAL(4, frames.size());
+   BOOST_CHECK_EQUAL(TRACE_NAME_TYPE, frames[0].first);
+   BOOST_CHECK_EQUAL(string("\0tick", 5), frames[0].second);
+   BOOST_CHECK_EQUAL(string("\1pos", 4), frames[1].second);
+
+   // Only the last 8 records are kept, 6 per frame.
+   BOOST_CHECK_EQUAL(TRACE_RECORDS_TYPE, frames[2].first);
+   BOOST_CHECK_EQUAL(6 * TRACE_RECORD_SIZE, frames[2].second.size());
+   BOOST_CHECK_EQUAL(2 * TRACE_RECORD_SIZE, frames[3].second.size());
+
+   // First kept record is the counter in the 8th tick, followed by its end.
+   const string& r = frames[2].second;
+   int32_t value;
+   memcpy(&value, r.data() + 4, 4);
+   BOOST_CHECK_EQUAL(7, value);
+   BOOST_CHECK_EQUAL(uint8_t(trace_kind::COUNTER), uint8_t(r[8]));
+   BOOST_CHECK_EQUAL(pos, uint8_t(r[9]));
+   BOOST_CHECK_EQUAL(uint8_t(trace_kind::END), uint8_t(r[TRACE_RECORD_SIZE + 8]));
+   BOOST_CHECK_EQUAL(tick, uint8_t(r[TRACE_RECORD_SIZE + 9]));
+
+   mock_virtual_time(false);
+}
@@ -37,3 +37,29 @@ BOOST_AUTO_TEST_CASE(test_before)
    // 58 minutes is before 30 if now is 60.
    BOOST_CHECK(before(60 * MINUTE, 58 * MINUTE, 30 * MINUTE));   
 }
+
+BOOST_AUTO_TEST_CASE(test_extended_clock_counts_wraps)
+{
+   extended_clock clock;
+   BOOST_CHECK_EQUAL(0, clock.extend(0));
+   BOOST_CHECK_EQUAL(0x7ffffff0ull, clock.extend(0x7ffffff0));
+   BOOST_CHECK_EQUAL(0xfffffff0ull, clock.extend(0xfffffff0));
+   BOOST_CHECK_EQUAL(0x100000005ull, clock.extend(5));
+   BOOST_CHECK_EQUAL(0x180000000ull, clock.extend(0x80000000));
+   BOOST_CHECK_EQUAL(0x200000000ull, clock.extend(0));
+}
+
+BOOST_AUTO_TEST_CASE(test_extended_clock_handles_readings_older_than_last)
+{
+   extended_clock clock;
+   clock.extend(0x80000000);
+   clock.extend(0xfffffff0);
+   BOOST_CHECK_EQUAL(0x100000005ull, clock.extend(5));
+
+   // A reading from before the wrap done after (like when an interrupt extends in between read and extend).
+   BOOST_CHECK_EQUAL(0xfffffffaull, clock.extend(0xfffffffa));
+
+   // And from after the wrap, but before the last one.
+   BOOST_CHECK_EQUAL(0x100000003ull, clock.extend(3));
+   BOOST_CHECK_EQUAL(0x100000006ull, clock.extend(6));
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+//
+// Tracing of spans (begin/end), instant events and counters as compact binary records in a RAM ring, the oldest
+// records are overwritten when full. Records are sent as telemetry frames when streaming (or dumping on demand) and
+// tools/trace-chrome.py converts them to Chrome trace json (chrome://tracing or https://ui.perfetto.dev).
+//
+// Names are registered once (typically in a static at the trace point) and referred to by id in the records:
+//
+//   static const uint8_t TICK = trace.name("tick");
+//   trace.begin(TICK);
+//   ...
+//   trace.end(TICK);
+//
+// Frames:
+//
+//   TRACE_NAME_TYPE    | id | name
+//   TRACE_RECORDS_TYPE | records, each when (uint32 us) | value (int32) | kind (uint8) | id (uint8)
+//
+
+#include "containers.hpp"
+#include "event_queue.hpp"
+#include "telemetry.hpp"
+
+#define TRACE_NAME_TYPE    0xf0
+#define TRACE_RECORDS_TYPE 0xf1
+
+// Max number of names.
+#ifndef TRACE_NAMES
+#define TRACE_NAMES 16
+#endif
+
+enum class trace_kind : uint8_t
+{
+   BEGIN,
+   END,
+   INSTANT,
+   COUNTER,
+};
+
+struct trace_record
+{
+   uint32_t when;
+   int32_t value;
+   trace_kind kind;
+   uint8_t id;
+};
+
+// Packed size of a record in frames.
+#define TRACE_RECORD_SIZE 10
+
+template<uint16_t size>
+struct tracer : event_queue::callback_obj_at
+{
+   static_assert((size & (size - 1)) == 0, "size needs to be a power of two");
+
+   tracer(event_queue& event_queue, telemetry& telemetry, const delay_t& interval=10 * MILLIS) :
+      _event_queue(event_queue), _telemetry(telemetry), _interval(interval), _names_sent(0), _count(0),
+      _sent(0), _continuous(false), _enabled(true)
+   {}
+
+   // Register name (needs to live as long as the tracer), returns id to use in records.
+   uint8_t name(const char* name)
+   {
+      for (uint8_t i = 0; i < _names.size(); ++i) {
+         if (strcmp(_names[i], name) == 0) {
+            return i;
+         }
+      }
+      if (not _names.push_back(name)) {
+         return TRACE_NAMES - 1;
+      }
+      return _names.size() - 1;
+   }
+
+   inline void begin(uint8_t id) { _record(trace_kind::BEGIN, id, 0); }
+
+   inline void end(uint8_t id) { _record(trace_kind::END, id, 0); }
+
+   inline void instant(uint8_t id, int32_t value=0) { _record(trace_kind::INSTANT, id, value); }
+
+   inline void counter(uint8_t id, int32_t value) { _record(trace_kind::COUNTER, id, value); }
+
+   // Stop or start recording, recording is on from start.
+   void enable(bool enabled)
+   {
+      _enabled = enabled;
+   }
+
+   // Send the records in the ring (as they are sent, new records are also sent until caught up).
+   void dump()
+   {
+      _sent = _count > size ? _count - size : 0;
+      _names_sent = 0;
+      _continuous = false;
+      _start();
+   }
+
+   // Continuously send new records, from now.
+   void stream()
+   {
+      _sent = _count;
+      _names_sent = 0;
+      _continuous = true;
+      _start();
+   }
+
+   void stop()
+   {
+      _continuous = false;
+   }
+
+   // Send as much as there is room for, then come back later.
+   void operator()(event_queue& eq, const timestamp_t& when) override
+   {
+      while (_names_sent < _names.size()) {
+         uint8_t frame[TELEMETRY_FRAME_SIZE - 2];
+         uint8_t len = min(uint32_t(strlen(_names[_names_sent])), uint32_t(sizeof(frame) - 1));
+         frame[0] = _names_sent;
+         memcpy(frame + 1, _names[_names_sent], len);
+         if (not _telemetry.send_raw(TRACE_NAME_TYPE, frame, len + 1)) {
+            eq.enqueue_at(this, when + _interval);
+            return;
+         }
+         ++_names_sent;
+      }
+
+      while (true) {
+         uint32_t count;
+         {
+            interrupt_lock lock;
+            count = _count;
+         }
+         if (count - _sent > size) {
+            // Overwritten before sent.
+            _sent = count - size;
+         }
+         if (_sent == count) {
+            break;
+         }
+
+         uint8_t frame[(TELEMETRY_FRAME_SIZE - 2) / TRACE_RECORD_SIZE * TRACE_RECORD_SIZE];
+         uint8_t n = 0;
+         for (; n < sizeof(frame) / TRACE_RECORD_SIZE and _sent + n != count; ++n) {
+            trace_record r;
+            {
+               interrupt_lock lock;
+               r = _records[(_sent + n) & (size - 1)];
+            }
+            uint8_t* p = frame + n * TRACE_RECORD_SIZE;
+            memcpy(p, &r.when, 4);
+            memcpy(p + 4, &r.value, 4);
+            p[8] = uint8_t(r.kind);
+            p[9] = r.id;
+         }
+         if (not _telemetry.send_raw(TRACE_RECORDS_TYPE, frame, n * TRACE_RECORD_SIZE)) {
+            break;
+         }
+         _sent += n;
+      }
+
+      if (_continuous or _sent != _count) {
+         eq.enqueue_at(this, when + _interval);
+      }
+   }
+
+private:
+
+   void _start()
+   {
+      if (not _event_queue.present(this)) {
+         _event_queue.enqueue_now(this);
+      }
+   }
+
+   inline void _record(trace_kind kind, uint8_t id, int32_t value)
+   {
+      if (not _enabled) {
+         return;
+      }
+      uint32_t now = micros();
+      interrupt_lock lock;
+      trace_record& r = _records[_count & (size - 1)];
+      r.when = now;
+      r.value = value;
+      r.kind = kind;
+      r.id = id;
+      ++_count;
+   }
+
+   event_queue& _event_queue;
+   telemetry& _telemetry;
+   delay_t _interval;
+
+   static_vector<const char*, TRACE_NAMES> _names;
+   uint8_t _names_sent;
+
+   // Total number of records and number of records sent.
+   trace_record _records[size];
+   volatile uint32_t _count;
+   uint32_t _sent;
+
+   bool _continuous;
+   bool _enabled;
+};
@@ -1,14 +1,15 @@
 #pragma once
 
-constexpr uint32_t MAX_TIMESTAMP = 0xffffffff; // 4.23e9 us or 71.58 minutes
+constexpr timestamp_t MAX_TIMESTAMP = timestamp_t(-1); // 4.23e9 us or 71.58 minutes with 32 bit timestamps
 constexpr uint32_t MILLIS = 1000;
 constexpr uint32_t SECOND = 1000 * MILLIS;
 constexpr uint32_t MINUTE = 60 * SECOND;
 
-// Returns true if x is before y. Can only used reliably for values in the interval -5 mins to +65 mins from now.
+// Returns true if x is before y. Can only used reliably for values in the interval -5 mins to +65 mins from now (with
+// 64 bit timestamps the upper limit is way beyond the lifetime of the device).
 bool before(const timestamp_t& now, const timestamp_t& x, const timestamp_t& y) {
-   constexpr uint32_t _5_MINS = 5 * MINUTE;
-   return uint32_t(x - now + _5_MINS) < uint32_t(y - now + _5_MINS);
+   constexpr timestamp_t _5_MINS = 5 * MINUTE;
+   return timestamp_t(x - now + _5_MINS) < timestamp_t(y - now + _5_MINS);
 }
 
 // Busy wait until timestamp, timestamp can be int he interval -5 mins to +65 minutes from now.
@@ -32,6 +33,11 @@ struct button
       pinMode(pin, INPUT);
    }
 
+   pin_t pin() const
+   {
+      return _pin;
+   }
+
    // Read button value and return it.
    bool value()
    {
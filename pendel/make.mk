@@ -3,5 +3,6 @@ MAIN = pendel/pendel
 # MAIN = pendel/trial
 
 BOARD = Teensy32
+# BOARD = Native
 
 BAUD_RATE = 57600
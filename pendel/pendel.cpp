@@ -12,21 +12,44 @@
 
 #define EVENT_QUEUE_DEBUG 8
 
+// Runs for hours, use wrap free timestamps.
+#define TIMESTAMP_BITS 64
+
+// Stepping goes in a lane of its own, so it wins over serial output and other work when both are due.
+#define EVENT_LANES 2
+#define STEP_LANE 1
+
 void log(const char* what);
 
+// Trace event queue dispatches, control ticks and steps, stream to host with make trace (see lib/trace.hpp).
+#define TRACE_ENABLED 0
+
+#if TRACE_ENABLED
+void trace_dispatch(bool begin, unsigned char lane);
+#define EVENT_QUEUE_TRACE(begin, lane) trace_dispatch(begin, lane)
+#endif
+
+// Profile step, enqueue and run, report printed every PROFILE_REPORT_INTERVAL (see lib/profile.hpp).
+#define PROFILE_ENABLED 0
+#define PROFILE_REPORT_INTERVAL (10 * SECOND)
+
 #include "Arduino.h"
 #include "lib/base.hpp"
 #include "lib/util.hpp"
 #include "lib/stepper.hpp"
 #include "lib/event_queue.hpp"
 #include "lib/event_utils.hpp"
+#include "lib/containers.hpp"
 #include "lib/serial.hpp"
 #include "lib/rotary_encoder.hpp"
 #include "lib/debug.hpp"
+#include "lib/telemetry.hpp"
+#include "lib/params.hpp"
+#include "lib/trace.hpp"
+#include "lib/button.hpp"
 #include "pins.hpp"
 
 #define SMOOTH_DELAY       200
-#define MAX_ACCELERATION 60000
 #define MAX_SPEED        16000
 #define APPROX_DISTANCE  3000
 
@@ -40,6 +63,31 @@ constexpr uint32_t BUTTON_READ_DELAY = 1 * MILLIS;
 
 constexpr uint16_t ENCODER_REV_TICKS = 2048;
 
+// Encoder index pulse (Z) gives absolute angle, so there is no need to wait for still and calibrate down.
+#ifdef ENC_Z
+constexpr bool ENCODER_INDEX = true;
+#else
+constexpr bool ENCODER_INDEX = false;
+#define ENC_Z ENCODER_NO_PIN
+#endif
+
+// Raw angle of the index pulse with down as 0, to find it run with 0 and print encoder.index_error() after calibrating
+// down and swinging one lap (see rotary_encoder::index).
+constexpr ang_t ENCODER_INDEX_RAW = 0;
+
+// Encoder edges closer than this (us) are noise from the stepper driver, fastest swings give about 150 us between edges.
+constexpr uint16_t ENCODER_MIN_EDGE_US = 20;
+
+// Tunable at runtime over serial, see lib/params.hpp.
+uint32_t max_acceleration = 60000;
+delay_t tick = MILLIS * 10;
+float kp = 1.000;
+float kd = 0.400;
+uint16_t swing_dist = 300;         // Swing distance from middle at zero speed.
+uint16_t swing_speed_offset = 20;  // Speed where swing distance starts to shrink.
+uint16_t swing_speed_factor = 6;   // Swing distance shrink per speed above offset.
+uint16_t jerk_dist = 400;          // Jerk distance from middle to start swinging.
+
 event_queue eq;
 
 debug_log<32> debug;
@@ -50,11 +98,15 @@ void log(const char* what) {
 
 stepper stepper(DIR, STP, EN, M0, M1, M2, DIR_O, SMOOTH_DELAY);
 
-rotary_encoder<ENC_A, ENC_B, ENCODER_REV_TICKS> encoder;
+// Timestamp the last 8 edges for velocity estimation.
+rotary_encoder<ENCODER_REV_TICKS, encoder_mode::X2, 8> encoder(ENC_A, ENC_B);
+
+// Interrupt driven, callbacks are enqueued on release (or press) instead of polling.
+event_button start_but(eq, START_BUT);
+event_button paus_but(eq, PAUS_BUT);
 
-button start_but(START_BUT);
-button paus_but(PAUS_BUT);
-button emergency_but(EMERGENCY_BUT);
+// Stops on the first edge of a press, without waiting for the debounce.
+event_button emergency_but(eq, EMERGENCY_BUT, false, true);
 
 button m_end_switch(M_END, true);
 button o_end_switch(O_END, true);
@@ -75,6 +127,7 @@ int32_t o_end_pos;
 int32_t mid_pos;
 
 void calibrate_standby(event_queue& eq, const timestamp_t& when);
+void profile_report(event_queue& eq, const timestamp_t& when);
 void calibrate_move_clear_of_m_end(event_queue& eq, const timestamp_t& when);
 void calibrate_find_m_end(event_queue& eq, const timestamp_t& when);
 void calibrate_find_o_end(event_queue& eq, const timestamp_t& when);
@@ -85,8 +138,8 @@ void run_prepare(event_queue& eq, const timestamp_t& when);
 void run_standby(event_queue& eq, const timestamp_t& when);
 void run_step(event_queue& eq, const timestamp_t& when);
 void run_pause(event_queue& eq, const timestamp_t& when);
+void run_resume(event_queue& eq, const timestamp_t& when);
 void run_start(event_queue& eq, const timestamp_t& when);
-void run_wait_for_still(event_queue& eq, const timestamp_t& when);
 void run(event_queue& eq, const timestamp_t& when);
 
 void check_for_emergency_stop(event_queue& eq, const timestamp_t& when);
@@ -94,8 +147,50 @@ void emergency_stop();
 
 noblock_serial serial(&eq, 57600);
 
+// Send state every tick as binary telemetry (decode with make telemetry NAME=tick) instead of text on changes.
+constexpr bool BINARY_TELEMETRY = false;
+const telemetry_message<1, uint32_t, int32_t, int32_t, ang_t, ang_t, char, uint32_t, uint32_t>
+TM_TICK("tick", "tick,pos,new_target,up_ang,speed,state,enc_invalid,enc_glitches");
+
+// Ticks between resending the schema, so a decoder attached at any time learns it.
+constexpr uint16_t TM_DESCRIBE_TICKS = 200;
+uint16_t tm_describe_in = 0;
+
+telemetry telem(serial);
+
+#if TRACE_ENABLED
+tracer<64> trace(eq, telem);
+const uint8_t TRACE_LANE[] = { trace.name("lane 0"), trace.name("lane 1") };
+const uint8_t TRACE_TICK = trace.name("tick");
+const uint8_t TRACE_STEP = trace.name("step");
+
+void trace_dispatch(bool begin, unsigned char lane)
+{
+   begin ? trace.begin(TRACE_LANE[lane]) : trace.end(TRACE_LANE[lane]);
+}
+
+#define TRACE(call) trace.call
+#else
+#define TRACE(call)
+#endif
+
+params params(eq, serial);
+
 void setup()
 {
+   encoder.filter(ENCODER_MIN_EDGE_US);
+   if (ENCODER_INDEX) {
+      encoder.index(ENC_Z, ENCODER_INDEX_RAW);
+   }
+   
+   params.add("max_acceleration", max_acceleration);
+   params.add("tick", tick);
+   params.add("kp", kp);
+   params.add("kd", kd);
+   params.add("swing_dist", swing_dist);
+   params.add("swing_speed_offset", swing_speed_offset);
+   params.add("swing_speed_factor", swing_speed_factor);
+   params.add("jerk_dist", jerk_dist);
 }   
 
 uint32_t c = 0;
@@ -118,24 +213,30 @@ void loop()
    r_led.on();
    builtin_led.off();
 
-   eq.enqueue_now(check_for_emergency_stop);
-   eq.enqueue_now(calibrate_standby);
+   emergency_but.on_press(check_for_emergency_stop, STEP_LANE);
+   start_but.on_release(calibrate_standby);
+   params.start();
+   if (PROFILE_ENABLED) {
+      eq.enqueue_rel(profile_report, PROFILE_REPORT_INTERVAL);
+   }
    eq.run();
 }
 
-void calibrate_standby(event_queue& eq, const timestamp_t& when)
+void profile_report(event_queue& eq, const timestamp_t& when)
 {
-   if (not start_but.pressed()) {
-      eq.enqueue_rel(calibrate_standby, BUTTON_READ_DELAY);
-      return;
-   }
+   profile_dump(serial);
+   profile_reset();
+   eq.enqueue_at(profile_report, when + PROFILE_REPORT_INTERVAL);
+}
 
+void calibrate_standby(event_queue& eq, const timestamp_t& when)
+{
    g_led_blink.start(SLOW_BLINK_DELAY);
 
    serial.p("calibrating\n");
    
    // We need a fast acceleration to be able to stop when reaching end, but not crazy fast so we miss steps.
-   stepper.acceleration(MAX_ACCELERATION);
+   stepper.acceleration(max_acceleration);
       
    // As fast as possible but we need to be able to stop before crashing.
    stepper.target_speed(1300);
@@ -223,7 +324,7 @@ void calibrate_center(event_queue& eq, const timestamp_t& when)
       return;
    }
 
-   serial.p("calibrated to ", m_end_pos, " - ", mid_pos, " - ", o_end_pos, "\n");
+   SERIAL_F(serial, "calibrated to {} - {} - {}\n", m_end_pos, mid_pos, o_end_pos);
    
    eq.enqueue_now(run_prepare);
 }
@@ -235,20 +336,15 @@ void run_prepare(event_queue& eq, const timestamp_t& when)
    delay_unitl(stepper.off());
 
    stepper.target_speed(MAX_SPEED);
-   stepper.acceleration(MAX_ACCELERATION);
+   stepper.acceleration(max_acceleration);
 
    serial.p("standby for run\n");
    
-   eq.enqueue_now(run_standby);
+   start_but.on_release(run_standby);
 }
 
 void run_standby(event_queue& eq, const timestamp_t& when)
 {
-   if (not start_but.pressed()) {
-      eq.enqueue_rel(run_standby, BUTTON_READ_DELAY);
-      return;
-   }
-
    serial.p("running\n");
 
    eq.enqueue_now(run_start);
@@ -267,11 +363,11 @@ void run_pause(event_queue& eq, const timestamp_t& when)
       delay_unitl(stepper.off());
    }
    
-   if (not start_but.pressed()) {
-      eq.enqueue_rel(run_pause, 200 * MILLIS);
-      return;
-   }
-   
+   start_but.on_release(run_resume);
+}
+
+void run_resume(event_queue& eq, const timestamp_t& when)
+{
    serial.p("resuming\n");
    
    eq.enqueue_now(run_start);
@@ -285,31 +381,35 @@ constexpr ang_t DEG_22_5 = DEG_45 / 2;
 constexpr ang_t DOWN = 0;
 constexpr ang_t UP = -DEG_180;
 
-constexpr timestamp_t TICK = MILLIS * 10;
 constexpr uint32_t STATE_SIZE = 16;
 
 // Helper class for handling state.
 struct run_state {
 
-   uint8_t index;
+   // Measurements of one tick.
+   struct sample
+   {
+      ang_t ang_speed; // Angular speed measured in steps/tick, 1024 steps total.
+      ang_t up_ang;    // Position, relative to up.
+      ang_t down_ang;  // Position, relative to down.
+   };
 
    uint32_t    tick_count;             // Useful for debug printouts.
-   ang_t       _ang_speed[STATE_SIZE]; // Angular speed measured in steps/tick, 1024 steps total.
+   ring_buffer<sample, STATE_SIZE> _samples; // The last STATE_SIZE ticks, latest first.
+   float       ang_velocity;           // Angular speed in steps/tick from encoder edge timing, less quantized.
    ang_t       step_pos; 
    int32_t     step_speed;             // Number of steps since last tick.
-   ang_t       _up_ang[STATE_SIZE];     // Position, relative to up.
-   ang_t       _down_ang[STATE_SIZE];   // Position, relative to down.
    timestamp_t last_measure;           // Last time we did measure.
    
    run_state() {
       reset();
    }
 
-   inline ang_t& ang_speed(uint8_t i) { return _ang_speed[(index + i) % STATE_SIZE]; }
+   inline ang_t& ang_speed(uint8_t i) { return _samples[i].ang_speed; }
 
-   inline ang_t& up_ang(uint8_t i) { return _up_ang[(index + i) % STATE_SIZE]; }
+   inline ang_t& up_ang(uint8_t i) { return _samples[i].up_ang; }
 
-   inline ang_t& down_ang(uint8_t i) { return _down_ang[(index + i) % STATE_SIZE]; }
+   inline ang_t& down_ang(uint8_t i) { return _samples[i].down_ang; }
 
    // Reset encoder in the down position that we assume we are in.
    void calibrate_down()
@@ -365,12 +465,11 @@ struct run_state {
          
    void reset_state()
    {
-      index = STATE_SIZE - 1;
+      _samples.clear();
       for (uint32_t i = 0; i < STATE_SIZE; ++i) {
-         ang_speed(i) = 0;
-         up_ang(i) = -DEG_180;
-         down_ang(i) = 0;
+         _samples.push_back(sample{ 0, -DEG_180, 0 });
       }
+      ang_velocity = 0;
    }
    
    void reset()
@@ -384,7 +483,7 @@ struct run_state {
    void measure()
    {
       ++tick_count;
-      --index;
+      _samples.push_front_overwrite(sample{ 0, 0, 0 });
       auto now = now_us();
 
       auto p = stepper.pos();
@@ -392,15 +491,17 @@ struct run_state {
       step_pos = p;
       
       // Do the measurement.
-      down_ang(0) = encoder.ang(DOWN);
-      up_ang(0) = encoder.ang(UP);
+      auto snapshot = encoder.snapshot();
+      down_ang(0) = encoder.rel(snapshot.raw, DOWN);
+      up_ang(0) = encoder.rel(snapshot.raw, UP);
       ang_speed(0) = encoder.rel(down_ang(0), down_ang(1));
+      ang_velocity = encoder.velocity(now) * tick / SECOND;
 
       if (last_measure) {
-         auto tick_duration = now - last_measure;
-         uint32_t diff = abs(int32_t(tick_duration) - int32_t(TICK));
+         delay_t tick_duration = now - last_measure;
+         uint32_t diff = abs(int32_t(tick_duration) - int32_t(tick));
          if (MILLIS < diff * 2) {
-            serial.p("warning, tick was ", tick_duration, " us, diff ", diff, " us\n");
+            SERIAL_LOG_F(serial, log_level::WARN, "warning, tick was {} us, diff {} us\n", tick_duration, diff);
          }      
       }
       last_measure = now;
@@ -410,7 +511,13 @@ struct run_state {
 
 run_state rs;
 
-uint32_t wait_for_still_ticks;
+// Wait for the pendulum to be still before calibrating down, the number of ticks waited is kept in the event.
+struct run_wait_for_still
+{
+   uint32_t ticks;
+   
+   void operator()(event_queue& eq, const timestamp_t& when);
+};
 
 void run_start(event_queue& eq, const timestamp_t& when)
 {
@@ -421,11 +528,12 @@ void run_start(event_queue& eq, const timestamp_t& when)
    stepper.target_pos(mid_pos);
    rs.reset();
    if (not eq.present(run_step)) {
-      eq.enqueue_now(run_step);
+      eq.enqueue_now(run_step, STEP_LANE);
    }
-   wait_for_still_ticks = 0;
-   eq.enqueue_now(run_wait_for_still);
-   serial.p("waiting for still\n");
+   eq.enqueue_now(run_wait_for_still{0});
+   serial.p(encoder.indexed() ? "indexed\n" : "waiting for still\n");
+   TRACE(stream());
+   tm_describe_in = 0;
 }
 
 constexpr char STILL = 'p';
@@ -435,7 +543,7 @@ constexpr char MOVE_TO_MIDDLE = 'm';
 char state;
 char old_state;
 
-void run_wait_for_still(event_queue& eq, const timestamp_t& when)
+void run_wait_for_still::operator()(event_queue& eq, const timestamp_t& when)
 {
    if (paus_but.pressed()) {
       run(eq, when);
@@ -443,20 +551,27 @@ void run_wait_for_still(event_queue& eq, const timestamp_t& when)
    }
    
    rs.measure();
-   wait_for_still_ticks++;
+
+   if (encoder.indexed()) {
+      state = STILL;
+      eq.enqueue_rel(run, tick);
+      return;
+   }
    
-   if (wait_for_still_ticks < 10 or not rs.still()) {
-      eq.enqueue_rel(run_wait_for_still, TICK);
+   if (ticks + 1 < 10 or not rs.still()) {
+      eq.enqueue_rel(run_wait_for_still{ticks + 1}, tick);
       return;
    }
 
    state = STILL;
    rs.calibrate_down();
-   eq.enqueue_rel(run, TICK);
+   eq.enqueue_rel(run, tick);
 }
 
 void run(event_queue& eq, const timestamp_t& when)
 {
+   PROFILE_SCOPE("run");
+   
    if (m_end_switch.value() or o_end_switch.value()) {
       emergency_stop();
    }
@@ -470,6 +585,8 @@ void run(event_queue& eq, const timestamp_t& when)
       return;
    }
 
+   TRACE(begin(TRACE_TICK));
+   
    rs.measure();
 
    int32_t pos = stepper.pos();
@@ -497,7 +614,7 @@ void run(event_queue& eq, const timestamp_t& when)
       // Stepper will affect ang_speed, so true_speed is an attempt to calculate ang_speed as it would have been if
       // steper did not move.
       
-      float true_speed = ang_speed + rs.step_speed * ANG_PER_STEP;
+      float true_speed = rs.ang_velocity + rs.step_speed * ANG_PER_STEP;
 
       if (abs_speed < MAX_BALANCE_ANG_SPEED and true_speed < MAX_BALANCE_ANG_SPEED) {
          state = BALANCE;
@@ -505,11 +622,8 @@ void run(event_queue& eq, const timestamp_t& when)
       
          // PD Regulation.
       
-         constexpr float Kp = 1.000;
-         constexpr float Kd = 0.400;
-      
-         float p_steps = Kp * up_ang * STEPS_PER_ANG;
-         float d_steps = Kd * true_speed * ANG_PER_SPEED * STEPS_PER_ANG;
+         float p_steps = kp * up_ang * STEPS_PER_ANG;
+         float d_steps = kd * true_speed * ANG_PER_SPEED * STEPS_PER_ANG;
 
          new_target = pos + p_steps + d_steps;
 
@@ -547,19 +661,19 @@ void run(event_queue& eq, const timestamp_t& when)
             if (rs.going_down() and abs(down_ang) < DEG_90) {
          
                // Adaptive swing.
-               uint32_t swing_dist = 300 - (abs_speed - 20) * 6;
+               int32_t dist = swing_dist - (int32_t(abs_speed) - swing_speed_offset) * swing_speed_factor;
                if (ang_speed < 0 and pos <= mid_pos) {
                   what = "swing regulated m => o";
-                  new_target = mid_pos + swing_dist;
+                  new_target = mid_pos + dist;
                }
                else if (ang_speed > 0 and pos >= mid_pos) {
                   what = "swing regulated m <= o";
-                  new_target = mid_pos - swing_dist;
+                  new_target = mid_pos - dist;
                }
             }
             else if (ang_speed == 0 and pos == mid_pos) {
                what = "jerk >= o";
-               new_target = mid_pos + 400;
+               new_target = mid_pos + jerk_dist;
             }
          }
       }
@@ -576,23 +690,39 @@ void run(event_queue& eq, const timestamp_t& when)
          new_target = o_end_pos - 100;
       }
       stepper.target_pos(new_target);
-      serial.p(what,
-               ", pos ", pos,
-               // ", target ", target,
-               ", new_target ", new_target,
-               // " (", new_target - pos, ")",
-               " up_ang ", up_ang,
-               ", speed ", ang_speed,
-               // ", tick ", rs.tick_count,
-               ", ", limited_message, "\n");
+      if (not BINARY_TELEMETRY) {
+         static log_site run_site(25);
+         serial.log(run_site, log_level::DEBUG, what,
+                    ", pos ", pos,
+                    // ", target ", target,
+                    ", new_target ", new_target,
+                    // " (", new_target - pos, ")",
+                    " up_ang ", up_ang,
+                    ", speed ", ang_speed,
+                    // ", tick ", rs.tick_count,
+                    ", ", limited_message, "\n");
+      }
    };
 
+   if (BINARY_TELEMETRY) {
+      if (tm_describe_in > 0) {
+         --tm_describe_in;
+      }
+      else if (telem.describe(TM_TICK)) {
+         tm_describe_in = TM_DESCRIBE_TICKS;
+      }
+      telem.send(TM_TICK, rs.tick_count, pos, new_target, up_ang, ang_speed, state, encoder.invalid(),
+                 encoder.glitches());
+   }
+
    if (state != old_state) {
-      serial.p("state change ", old_state, " => ", state, "\n");
+      SERIAL_F(serial, "state change {} => {}\n", old_state, state);
       old_state = state;
    }
    
-   eq.enqueue_at(run, when + TICK);
+   TRACE(end(TRACE_TICK));
+   
+   eq.enqueue_at(run, when + tick);
 }
 
 // Run stepper in its own "thread".
@@ -603,11 +733,12 @@ void run_step(event_queue& eq, const timestamp_t& when)
    }
 
    if (stepper.is_stopped()) {
-      eq.enqueue_rel(run_step, MILLIS);
+      eq.enqueue_rel(run_step, MILLIS, STEP_LANE);
       return;
    }
 
-   eq.enqueue_at(run_step, stepper.step());
+   TRACE(instant(TRACE_STEP, stepper.pos()));
+   eq.enqueue_at(run_step, stepper.step(), STEP_LANE);
 }
 
 void check_for_emergency_stop(event_queue& eq, const timestamp_t& when)
@@ -616,7 +747,7 @@ void check_for_emergency_stop(event_queue& eq, const timestamp_t& when)
       emergency_stop();
       return;
    }
-   eq.enqueue_rel(check_for_emergency_stop, BUTTON_READ_DELAY);
+   emergency_but.on_press(check_for_emergency_stop, STEP_LANE);
 }
 
 void emergency_stop()
@@ -47,6 +47,7 @@
 
 #define ENC_B 8
 #define ENC_A 9
+// #define ENC_Z 10
 
 // knappar
 
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+#
+# Decode binary telemetry (lib/telemetry.hpp) from a file or serial device into csv, for example for
+# dev-stepper/plot-csv.py.
+#
+# Usage: telemetry-csv.py <input> <message name> [<output csv>]
+#
+
+import sys
+import struct
+
+
+def crc8(data):
+    """ CRC-8 with polynomial 0x07, same as crc8 in lib/framing.hpp. """
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xff if crc & 0x80 else (crc << 1) & 0xff
+    return crc
+
+
+def cobs_decode(data):
+    """ Decode COBS encoded frame (without ending zero), returns None if malformed. """
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xff and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def frames(stream):
+    """ Yield decoded frames (type, payload) with valid crc from stream, everything else is dropped. """
+    buf = bytearray()
+    while True:
+        chunk = stream.read(1)
+        if not chunk:
+            return
+        if chunk[0] != 0:
+            buf += chunk
+            continue
+        frame = cobs_decode(bytes(buf))
+        buf.clear()
+        if frame and len(frame) >= 2 and crc8(frame[:-1]) == frame[-1]:
+            yield frame[0], frame[1:-1]
+
+
+def main(args):
+    if len(args) < 2:
+        print(__doc__ or "usage: telemetry-csv.py <input> <message name> [<output csv>]", file=sys.stderr)
+        return 1
+
+    input_name, message_name = args[0], args[1]
+    out = open(args[2], 'w') if len(args) > 2 else sys.stdout
+
+    schemas = {}
+    header_written = False
+    with open(input_name, 'rb', buffering=0) as stream:
+        for type_id, payload in frames(stream):
+            if type_id == 0:
+                described, rest = payload[0], payload[1:]
+                name, fmt, columns = rest.split(b'\0', 2)
+                schemas[described] = (name.decode(), '<' + fmt.decode(), columns.decode())
+                continue
+
+            schema = schemas.get(type_id)
+            if not schema or schema[0] != message_name:
+                continue
+
+            name, fmt, columns = schema
+            if struct.calcsize(fmt) != len(payload):
+                print("size mismatch for %s, dropping frame" % name, file=sys.stderr)
+                continue
+
+            if not header_written:
+                print(columns, file=out)
+                header_written = True
+
+            print(",".join(str(v) for v in struct.unpack(fmt, payload)), file=out, flush=True)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
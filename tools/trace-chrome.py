@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+#
+# Convert trace records (lib/trace.hpp) from a file or serial device into Chrome trace json, open it in
+# chrome://tracing or https://ui.perfetto.dev. Reads until end of input or ctrl-c.
+#
+# Usage: trace-chrome.py <input> [<output json>]
+#
+
+import os
+import sys
+import json
+import struct
+import importlib.util
+
+spec = importlib.util.spec_from_file_location(
+    "telemetry_csv", os.path.join(os.path.dirname(os.path.abspath(__file__)), "telemetry-csv.py"))
+telemetry_csv = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(telemetry_csv)
+
+TRACE_NAME_TYPE = 0xf0
+TRACE_RECORDS_TYPE = 0xf1
+RECORD = struct.Struct('<iiBB')
+
+PHASES = {0: 'B', 1: 'E', 2: 'i', 3: 'C'}
+
+
+def events(stream):
+    """ Yield chrome trace events from stream, timestamps are unwrapped from 32 bit micros. """
+    names = {}
+    epoch = 0
+    last = None
+    for type_id, payload in telemetry_csv.frames(stream):
+        if type_id == TRACE_NAME_TYPE:
+            names[payload[0]] = payload[1:].decode(errors='replace')
+            continue
+
+        if type_id != TRACE_RECORDS_TYPE:
+            continue
+
+        for offset in range(0, len(payload) - RECORD.size + 1, RECORD.size):
+            when, value, kind, name_id = RECORD.unpack_from(payload, offset)
+            when &= 0xffffffff
+            if last is not None and when < last and last - when > 1 << 31:
+                epoch += 1 << 32
+            last = when
+
+            name = names.get(name_id, "id %d" % name_id)
+            event = dict(name=name, ph=PHASES.get(kind, 'i'), ts=epoch + when, pid=0, tid=0)
+            if kind == 2:
+                event['s'] = 't'
+                event['args'] = dict(value=value)
+            elif kind == 3:
+                event['args'] = {name: value}
+            yield event
+
+
+def main(args):
+    if len(args) < 1:
+        print("usage: trace-chrome.py <input> [<output json>]", file=sys.stderr)
+        return 1
+
+    result = []
+    try:
+        with open(args[0], 'rb', buffering=0) as stream:
+            for event in events(stream):
+                result.append(event)
+    except KeyboardInterrupt:
+        pass
+
+    out = open(args[1], 'w') if len(args) > 1 else sys.stdout
+    json.dump(dict(traceEvents=result, displayTimeUnit='ns'), out)
+    print(file=out)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))